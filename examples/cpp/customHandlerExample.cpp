@@ -21,7 +21,10 @@ class customLogHandler  : public logHandler
                  const char* message,
                  size_t message_len) 
     {
-        cout << "customLogHandler: " << setw(5)
+        // time is nanoseconds since the epoch
+        cout << "customLogHandler: " << time / 1000000000 << "."
+             << setfill ('0') << setw(9) << time % 1000000000
+             << setfill (' ') << " " << setw(5)
              << logHandler::severityToString (severity)
              << ": " << message << endl;
     }
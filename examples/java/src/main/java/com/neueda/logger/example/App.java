@@ -24,16 +24,22 @@ public class App
 	}
 
 	public String getFormat() {
-	    return "{severity} {name} {time} {message}";
+	    return "{severity} {name} {message}";
 	}
 
+	// time is nanoseconds since the epoch
 	public void handle (LogSeverity.level severity,
 			    String name,
 			    java.math.BigInteger time,
 			    String message,
 			    long message_len) 
 	{
-	    System.out.println ("customLogHandler: " +
+	    java.math.BigInteger[] parts =
+		time.divideAndRemainder (java.math.BigInteger.valueOf (1000000000L));
+	    java.time.Instant when =
+		java.time.Instant.ofEpochSecond (parts[0].longValue (),
+						 parts[1].longValue ());
+	    System.out.println ("customLogHandler: " + when + " " +
 				LogHandler.toString (getFormat(),
 						     severity,
 						     name,
@@ -25,6 +25,12 @@ consoleLogHandler::consoleLogHandler ()
       mOutput (stdout),
       mColorEnabled (false)
 {
+    sbfMutex_init (&mMutex, 0);
+}
+
+consoleLogHandler::~consoleLogHandler ()
+{
+    sbfMutex_destroy (&mMutex);
 }
 
 void
@@ -34,45 +40,54 @@ consoleLogHandler::handle (logSeverity::level severity,
                            const char* message,
                            size_t message_len)
 {
-    std::string logMessage = toString (mFormat,
-                                       severity,
-                                       name,
-                                       time,
-                                       message,
-                                       message_len);
+    const char* color = mColorEnabled ? colorCode (severity) : NULL;
+
+    sbfMutex_lock (&mMutex);
 
-    if (mColorEnabled)
-        logMessage = colorize (severity, logMessage);
+    mLine.clear ();
+    if (color != NULL)
+        mLine.append ("\033[1;").append (color).append ("m");
 
-    fprintf (mOutput, "%s\n", logMessage.c_str ());
+    mFormatter.render (mLine,
+                       severity,
+                       name,
+                       time,
+                       message,
+                       message_len);
+
+    if (color != NULL)
+        mLine.append ("\033[0m");
+    mLine.push_back ('\n');
+
+    fwrite (mLine.data (), 1, mLine.size (), mOutput);
+
+    sbfMutex_unlock (&mMutex);
 }
 
-std::string
-consoleLogHandler::colorize (logSeverity::level severity,
-                             const std::string& message)
+const char*
+consoleLogHandler::colorCode (logSeverity::level severity)
 {
-
     switch (severity)
     {
     case logSeverity::INFO:
-        return message;
+        return NULL;
 
     case logSeverity::WARN:
-        return "\033[1;" CONSOLE_HANDLER_YELLOW "m" + message + "\033[0m";
+        return CONSOLE_HANDLER_YELLOW;
 
     case logSeverity::ERROR:
-        return "\033[1;" CONSOLE_HANDLER_RED "m" + message + "\033[0m";
+        return CONSOLE_HANDLER_RED;
 
     case logSeverity::DEBUG:
-        return message;
+        return NULL;
 
     case logSeverity::TRACE:
-        return message;
+        return NULL;
 
     case logSeverity::FATAL:
-        return "\033[1;" CONSOLE_HANDLER_RED "m" + message + "\033[0m";
+        return CONSOLE_HANDLER_RED;
     }
-    return message;
+    return NULL;
 }
 
 }
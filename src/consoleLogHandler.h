@@ -15,6 +15,8 @@ class consoleLogHandler: public logHandler
 public:
     consoleLogHandler ();
 
+    ~consoleLogHandler ();
+
     void teardown () { }
 
     void handle (logSeverity::level severity,
@@ -28,10 +30,12 @@ public:
     void setColorEnabled (bool enabled) { mColorEnabled = enabled; }
 
 private:
-    std::string colorize (logSeverity::level severity, const std::string& message);
+    static const char* colorCode (logSeverity::level severity);
 
-    FILE*   mOutput;
-    bool    mColorEnabled;
+    FILE*       mOutput;
+    bool        mColorEnabled;
+    std::string mLine;
+    sbfMutex    mMutex;
 };
 
 };
@@ -14,6 +14,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -30,19 +31,18 @@ consumeSharedMemory (void* closure)
     logService& logService = logService::get ();
     sharedMemoryRingBuffer* sharedMemory = (sharedMemoryRingBuffer*)closure;
 
+    std::vector<char> buffer;
     while (gConsumerRunning)
     {
-        logEntry entry;
-        if (sharedMemory->blockingDequeue (&entry))
+        if (sharedMemory->blockingDequeue (buffer))
         {
-            // FIXME overflow here need to check for null terminator
-	    // could be full defaultLogMessageChunkSize;
-	    string message (entry.mMessage);
-            logService.handle (string (entry.mName),
-                               entry.severity,
-                               entry.mTime,
-                               message.c_str (),
-                               message.size ());
+            const logRecord* record =
+                reinterpret_cast<const logRecord*>(&buffer[0]);
+            logService.handle (string (record->getName (), record->mNameLen),
+                               record->getSeverity (),
+                               record->mTime,
+                               record->getMessage (),
+                               record->mMessageLen);
         }
     }
     return NULL;
@@ -5,81 +5,540 @@
 #include "fileLogHandler.h"
 
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
+#include <set>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <zlib.h>
 #include "sbfCommon.h"
 
+// handlers with lines pending at exit, see fileLogHandler::flushAll
+static std::set<neueda::fileLogHandler*>* openHandlers = NULL;
+static sbfMutex openMutex;
+static pthread_once_t openOnce = PTHREAD_ONCE_INIT;
+
+// each of the writer thread's two buffers when no size is given
+static const size_t defaultWriterBufferSize = 1024 * 1024;
+
+// how much of a mapped file is mapped at once, a multiple of the page size
+static const uint64_t mapWindowSize = 16 * 1024 * 1024;
+
 namespace neueda
 {
 
+static uint64_t
+realtimeNanos ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+initOpenHandlers ()
+{
+    sbfMutex_init (&openMutex, 0);
+    openHandlers = new std::set<fileLogHandler*> ();
+    atexit (fileLogHandler::flushAll);
+}
+
 fileLogHandler::fileLogHandler (const string& path,
                                 const size_t limit,
                                 const int fileCount) :
     logHandler (),
-    mFile (NULL),
+    mFd (-1),
     mPath (path),
+    mCurrent (path),
+    mNaming (logSegments::NAMING_RENAME),
+    mCompress (false),
+    mSegments (NULL),
+    mCompressed (false),
+    mDeflate (NULL),
     mSize (0),
     mSizeLimit (limit),
     mCountLimit (fileCount),
-    mCount (0)
+    mCount (0),
+    mBufferSize (0),
+    mFlushInterval (0),
+    mFlushLevel (logSeverity::ERROR),
+    mWriterThread (false),
+    mBackRoll (false),
+    mBackStart (0),
+    mRotateInterval (0),
+    mRotateAt (0),
+    mPeriodStart (0),
+    mRollPending (false),
+    mOffset (0),
+    mMapped (false),
+    mMapping (false),
+    mMap (NULL),
+    mMapStart (0),
+    mMapSize (0),
+    mAllocated (0),
+    mThreadRunning (false),
+    mWriting (false),
+    mStopping (false)
 {
+    sbfMutex_init (&mMutex, 0);
+    sbfCondVar_init (&mCond);
+    sbfCondVar_init (&mSpace);
 }
 
 fileLogHandler::~fileLogHandler ()
 {
+    teardown ();
+
+    sbfCondVar_destroy (&mSpace);
+    sbfCondVar_destroy (&mCond);
+    sbfMutex_destroy (&mMutex);
+}
+
+void
+fileLogHandler::setBuffer (size_t size,
+                           uint64_t flushInterval,
+                           logSeverity::level flushLevel)
+{
+    mBufferSize = size;
+    mFlushInterval = flushInterval;
+    mFlushLevel = flushLevel;
 }
 
 bool
-fileLogHandler::setup ()
+fileLogHandler::open (time_t start)
 {
     errno = 0;
 
-    FILE* f = fopen (mPath.c_str (), "w");
-    if (f == NULL)
+    int fd;
+    if (mSegments != NULL)
+    {
+        string errorMessage;
+        fd = mSegments->next (mCurrent, errorMessage, start);
+        if (fd < 0)
+        {
+            ioError (errorMessage);
+            return false;
+        }
+    }
+    else
+    {
+        // a shared mapping needs the file open for reading too
+        int flags = (mMapped ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        fd = ::open ((mPath + mSuffix).c_str (), flags, 0666);
+        if (fd < 0)
+        {
+            ioError (strerror (errno));
+            return false;
+        }
+    }
+
+    mFd = fd;
+    mOffset = 0;
+    mAllocated = 0;
+
+    // the whole segment up front where its size is known, written instead
+    // when it cannot be reserved
+    mMapping = mMapped && (mSizeLimit == 0 || allocate (mSizeLimit));
+
+    return true;
+}
+
+void
+fileLogHandler::closeFile ()
+{
+    if (mMap != NULL)
     {
-        setLastError (strerror (errno));
+        munmap (mMap, mMapSize);
+        mMap = NULL;
+    }
+
+    // give back what was preallocated and not written
+    if (mMapped && ftruncate (mFd, mOffset) != 0)
+        ioError (strerror (errno));
+
+    close (mFd);
+    mFd = -1;
+}
+
+bool
+fileLogHandler::allocate (uint64_t length)
+{
+    if (length <= mAllocated)
+        return true;
+
+    // never a sparse file, a store into a hole the disk cannot fill is
+    // a SIGBUS rather than an error
+    if (fallocate (mFd, 0, mAllocated, length - mAllocated) != 0)
+    {
+        // the filesystem cannot reserve blocks, not an error as such
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+            ioError (strerror (errno));
         return false;
     }
 
-    // no buffering
-    setbuf (f, NULL);
+    mAllocated = length;
+    return true;
+}
 
-    errno = 0;
-    // get current size
-    struct stat sb;
-    if (fstat (fileno (f), &sb) != 0)
+bool
+fileLogHandler::remap ()
+{
+    if (mMap != NULL)
+    {
+        munmap (mMap, mMapSize);
+        mMap = NULL;
+    }
+
+    uint64_t window = windowSize ();
+    uint64_t start = mOffset - mOffset % window;
+    if (!allocate (start + window))
     {
-        setLastError (strerror (errno));
-        fclose (f);
+        // the rest of this file is written
+        mMapping = false;
         return false;
     }
 
-    mFile = f;
-    mSize = sb.st_size;
+    void* map = mmap (NULL,
+                      window,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      mFd,
+                      start);
+    if (map == MAP_FAILED)
+    {
+        ioError (strerror (errno));
+        return false;
+    }
 
+    mMap = static_cast<char*>(map);
+    mMapStart = start;
+    mMapSize = window;
+    return true;
+}
+
+uint64_t
+fileLogHandler::windowSize () const
+{
+    if (mSizeLimit == 0 || mSizeLimit >= mapWindowSize)
+        return mapWindowSize;
+
+    // no more than a small segment needs, in whole pages as the mapping
+    // must stay within the file
+    uint64_t page = sysconf (_SC_PAGESIZE);
+    return (mSizeLimit + page - 1) / page * page;
+}
+
+bool
+fileLogHandler::setup ()
+{
+    if (mCompressed)
+    {
+        mDeflate = new z_stream ();
+        if (deflateInit2 (mDeflate,
+                          Z_DEFAULT_COMPRESSION,
+                          Z_DEFLATED,
+                          MAX_WBITS + 16,   // gzip wrapping
+                          8,
+                          Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            setLastError ("failed to initialise compression");
+            delete mDeflate;
+            mDeflate = NULL;
+            return false;
+        }
+
+        mSuffix = ".gz";
+        mWriterThread = true;
+    }
+
+    if (mNaming != logSegments::NAMING_RENAME)
+    {
+        // already compressed files are not compressed again
+        mSegments = new logSegments (mPath,
+                                     mNaming,
+                                     mMapped ? O_RDWR : O_WRONLY,
+                                     mCountLimit,
+                                     mCompress && !mCompressed);
+        mSegments->setPeriod (mRotateInterval);
+        mSegments->setSuffix (mSuffix);
+
+        string errorMessage;
+        if (!mSegments->start (errorMessage))
+        {
+            setLastError (errorMessage);
+            delete mSegments;
+            mSegments = NULL;
+            return false;
+        }
+    }
+
+    mPeriodStart = periodOf (realtimeNanos ());
+    mRotateAt = (uint64_t)(mPeriodStart + mRotateInterval) * 1000000000;
+
+    if (!open (mPeriodStart))
+    {
+        delete mSegments;
+        mSegments = NULL;
+        return false;
+    }
+    mSize = 0;
+
+    if (mWriterThread && mBufferSize == 0)
+        mBufferSize = defaultWriterBufferSize;
+    if (mBufferSize > 0)
+    {
+        mBuffer.reserve (mBufferSize);
+        if (mWriterThread)
+            mBack.reserve (mBufferSize);
+
+        pthread_once (&openOnce, initOpenHandlers);
+        sbfMutex_lock (&openMutex);
+        openHandlers->insert (this);
+        sbfMutex_unlock (&openMutex);
+    }
+    else
+    {
+        // nothing is held back to flush
+        mFlushInterval = 0;
+    }
+
+    startThread ();
     return true;
 }
 
 void
 fileLogHandler::teardown ()
 {
-    if (mFile != NULL)
-        fclose (mFile);
+    if (mFd >= 0)
+    {
+        if (mBufferSize > 0)
+        {
+            sbfMutex_lock (&openMutex);
+            openHandlers->erase (this);
+            sbfMutex_unlock (&openMutex);
+        }
+
+        // the writer thread writes everything pending before it goes
+        stopThread ();
+
+        sbfMutex_lock (&mMutex);
+        write ();
+        closeFile ();
+        sbfMutex_unlock (&mMutex);
+    }
+
+    // the last file is left as it is, the next run picks it up
+    delete mSegments;
+    mSegments = NULL;
+
+    if (mDeflate != NULL)
+    {
+        deflateEnd (mDeflate);
+        delete mDeflate;
+        mDeflate = NULL;
+    }
+}
+
+void
+fileLogHandler::startThread ()
+{
+    if (!mWriterThread && mFlushInterval == 0 && mRotateInterval == 0)
+        return;
+
+    mStopping = false;
+    mThreadRunning = sbfThread_create (&mThread, fileLogHandler::threadCb, this) == 0;
+
+    // no thread to be had, write on the caller instead
+    if (!mThreadRunning)
+        mWriterThread = false;
+}
+
+void
+fileLogHandler::stopThread ()
+{
+    if (!mThreadRunning)
+        return;
+
+    sbfMutex_lock (&mMutex);
+    mStopping = true;
+    sbfCondVar_signal (&mCond);
+    sbfMutex_unlock (&mMutex);
+
+    sbfThread_join (mThread);
+    mThreadRunning = false;
+    mWriterThread = false;
+}
+
+void*
+fileLogHandler::threadCb (void* closure)
+{
+    fileLogHandler* self = static_cast<fileLogHandler*>(closure);
+
+    if (self->mWriterThread)
+        self->writeOnThread ();
+    else
+        self->flushOnTimer ();
+    return NULL;
+}
+
+void
+fileLogHandler::timedWait ()
+{
+    if (mFlushInterval == 0 && mRotateInterval == 0)
+    {
+        sbfCondVar_wait (&mCond, &mMutex);
+        return;
+    }
+
+    // whichever comes first of the flush interval and the next boundary
+    uint64_t deadline = realtimeNanos ();
+    if (mFlushInterval != 0)
+        deadline += mFlushInterval * 1000 * 1000;
+    if (mRotateInterval != 0 && (mFlushInterval == 0 || mRotateAt < deadline))
+        deadline = mRotateAt;
+
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    pthread_cond_timedwait (&mCond, &mMutex, &ts);
+}
+
+void
+fileLogHandler::flushOnTimer ()
+{
+    sbfMutex_lock (&mMutex);
+    while (!mStopping)
+    {
+        timedWait ();
+
+        // whatever is pending has waited at most one interval
+        rotateIfDue (realtimeNanos ());
+        write ();
+    }
+    sbfMutex_unlock (&mMutex);
 }
 
 void
-fileLogHandler::flush ()
+fileLogHandler::writeOnThread ()
 {
-    fflush (mFile);
+    sbfMutex_lock (&mMutex);
+    for (;;)
+    {
+        while (mBack.empty () && !mBackRoll && !mStopping)
+        {
+            timedWait ();
+
+            // lines left waiting a whole interval go out anyway
+            if (mBack.empty () && !mBackRoll)
+            {
+                rotateIfDue (realtimeNanos ());
+                write ();
+            }
+        }
+
+        // stopping, take what is left
+        if (mBack.empty () && !mBackRoll)
+            write ();
+        if (mBack.empty () && !mBackRoll)
+            break;
+
+        bool rolling = mBackRoll;
+        time_t start = mBackStart;
+        mWriting = true;
+        sbfMutex_unlock (&mMutex);
+
+        writeOut (mBack);
+        if (rolling)
+            roll (start);
+
+        sbfMutex_lock (&mMutex);
+        mWriting = false;
+        mBack.clear ();
+        mBackRoll = false;
+        sbfCondVar_broadcast (&mSpace);
+    }
+    sbfMutex_unlock (&mMutex);
 }
 
 void
-fileLogHandler::roll ()
+fileLogHandler::drain ()
+{
+    write ();
+    while (mWriterThread && (!mBack.empty () || mBackRoll))
+        sbfCondVar_wait (&mSpace, &mMutex);
+}
+
+void
+fileLogHandler::flushAll ()
+{
+    sbfMutex_lock (&openMutex);
+
+    std::set<fileLogHandler*>::iterator it;
+    for (it = openHandlers->begin (); it != openHandlers->end (); ++it)
+    {
+        fileLogHandler* handler = *it;
+
+        sbfMutex_lock (&handler->mMutex);
+        handler->drain ();
+        sbfMutex_unlock (&handler->mMutex);
+    }
+
+    sbfMutex_unlock (&openMutex);
+}
+
+void
+fileLogHandler::roll (time_t start)
+{
+    if (mSegments == NULL)
+    {
+        rollRenaming ();
+        return;
+    }
+
+    // the next file is already open, everything else is left to the
+    // segment thread
+    closeFile ();
+    mSegments->retire (mCurrent);
+    if (!open (start))
+        cerr << getLastError () << endl;
+}
+
+time_t
+fileLogHandler::periodOf (uint64_t time) const
+{
+    if (mRotateInterval == 0)
+        return 0;
+
+    uint64_t seconds = time / 1000000000;
+    return seconds - seconds % mRotateInterval;
+}
+
+void
+fileLogHandler::rotateIfDue (uint64_t time)
+{
+    // a late line from an earlier period stays in the current file
+    if (mRotateInterval == 0 || time < mRotateAt)
+        return;
+
+    // what is pending belongs to the period ending
+    mPeriodStart = periodOf (time);
+    mRotateAt = (uint64_t)(mPeriodStart + mRotateInterval) * 1000000000;
+    mRollPending = true;
+    write ();
+}
+
+void
+fileLogHandler::rollRenaming ()
 {
     string errorMessage;
 
@@ -94,12 +553,12 @@ fileLogHandler::roll ()
         to.str ("");
         from.str ("");
 
-        to << mPath << "." << i + 1;
+        to << mPath << "." << i + 1 << mSuffix;
 
         if (i == 0)
-            from << mPath;
+            from << mPath << mSuffix;
         else
-            from << mPath << "." << i;
+            from << mPath << "." << i << mSuffix;
 
         if (rename (from.str ().c_str (), to.str ().c_str ()) != 0)
         {
@@ -108,8 +567,8 @@ fileLogHandler::roll ()
         }
     }
 
-    fclose (mFile);
-    if (!setup ())
+    closeFile ();
+    if (!open (0))
     {
         cerr << getLastError () << endl;
         return;
@@ -117,6 +576,156 @@ fileLogHandler::roll ()
 }
 
 
+void
+fileLogHandler::append (const logBatchEntry& entry)
+{
+    size_t before = mBuffer.size ();
+    mFormatter.render (mBuffer,
+                       entry.mSeverity,
+                       entry.mName,
+                       entry.mTime,
+                       entry.mMessage,
+                       entry.mMessageLen);
+    mBuffer.push_back ('\n');
+    mSize += mBuffer.size () - before;
+}
+
+bool
+fileLogHandler::isFull () const
+{
+    // rolling happens exactly where it would record by record
+    return mBuffer.size () >= mBufferSize
+        || (mSizeLimit != 0 && mSize > mSizeLimit);
+}
+
+void
+fileLogHandler::write ()
+{
+    bool rolling = mRollPending || (mSizeLimit != 0 && mSize > mSizeLimit);
+    if (mBuffer.empty () && !rolling)
+        return;
+
+    if (mWriterThread)
+    {
+        // both buffers full, the only time the caller waits on the disk
+        while (!mBack.empty () || mBackRoll)
+            sbfCondVar_wait (&mSpace, &mMutex);
+
+        mBack.swap (mBuffer);
+        mBackRoll = rolling;
+        mBackStart = mPeriodStart;
+        sbfCondVar_signal (&mCond);
+    }
+    else
+    {
+        writeOut (mBuffer);
+        mBuffer.clear ();
+        if (rolling)
+            roll (mPeriodStart);
+    }
+
+    if (rolling)
+    {
+        mSize = 0;
+        mRollPending = false;
+    }
+}
+
+void
+fileLogHandler::writeOut (const std::string& data)
+{
+    if (mFd < 0 || data.empty ())
+        return;
+
+    if (mDeflate == NULL)
+        writeRaw (data.data (), data.size ());
+    else if (deflateOut (data))
+        writeRaw (mPacked.data (), mPacked.size ());
+}
+
+bool
+fileLogHandler::deflateOut (const std::string& data)
+{
+    // a whole gzip member, readable without anything written after it
+    mPacked.resize (deflateBound (mDeflate, data.size ()));
+
+    mDeflate->next_in = (Bytef*)data.data ();
+    mDeflate->avail_in = data.size ();
+    mDeflate->next_out = (Bytef*)&mPacked[0];
+    mDeflate->avail_out = mPacked.size ();
+
+    int rc = deflate (mDeflate, Z_FINISH);
+    mPacked.resize (mPacked.size () - mDeflate->avail_out);
+    deflateReset (mDeflate);
+
+    if (rc != Z_STREAM_END)
+    {
+        ioError ("failed to compress");
+        return false;
+    }
+    return true;
+}
+
+void
+fileLogHandler::writeRaw (const char* data, size_t length)
+{
+    // whatever cannot be mapped is written instead
+    size_t copied = mMapping ? copyOut (data, length) : 0;
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(data) + copied;
+    iov.iov_len = length - copied;
+    while (iov.iov_len > 0)
+    {
+        ssize_t n = pwritev (mFd, &iov, 1, mOffset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            // the rest of these lines is lost
+            ioError (n < 0 ? strerror (errno) : "short write");
+            break;
+        }
+
+        iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+        iov.iov_len -= n;
+        mOffset += n;
+    }
+}
+
+void
+fileLogHandler::ioError (const string& err)
+{
+    // everywhere else the caller already holds the lock
+    if (mWriting)
+        sbfMutex_lock (&mMutex);
+    setLastError (err);
+    if (mWriting)
+        sbfMutex_unlock (&mMutex);
+}
+
+size_t
+fileLogHandler::copyOut (const char* data, size_t length)
+{
+    size_t copied = 0;
+    while (copied < length)
+    {
+        if (mMap == NULL || mOffset >= mMapStart + mMapSize)
+        {
+            if (!remap ())
+                break;
+        }
+
+        size_t room = mMapStart + mMapSize - mOffset;
+        size_t n = length - copied < room ? length - copied : room;
+        memcpy (mMap + (mOffset - mMapStart), data + copied, n);
+
+        copied += n;
+        mOffset += n;
+    }
+    return copied;
+}
+
 void
 fileLogHandler::handle (logSeverity::level severity,
                         const char* name,
@@ -124,17 +733,43 @@ fileLogHandler::handle (logSeverity::level severity,
                         const char* message,
                         size_t message_len)
 {
-    string outStr = toString (mFormat,
-                              severity,
-                              name,
-                              time,
-                              message,
-                              message_len);
+    logBatchEntry entry = { severity, name, time, message, message_len };
+
+    sbfMutex_lock (&mMutex);
+
+    rotateIfDue (time);
+    append (entry);
+    if (isFull () || severity >= mFlushLevel)
+        write ();
+
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+fileLogHandler::handleBatch (const logBatchEntry* entries, size_t count)
+{
+    // render everything into the buffer for a single write, cut short
+    // wherever a record takes the file over its size limit
+    sbfMutex_lock (&mMutex);
+
+    bool urgent = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!isLevelEnabled (entries[i].mSeverity))
+            continue;
+
+        rotateIfDue (entries[i].mTime);
+        append (entries[i]);
+        if (mSizeLimit != 0 && mSize > mSizeLimit)
+            write ();
+        else if (entries[i].mSeverity >= mFlushLevel)
+            urgent = true;
+    }
 
-    mSize += fprintf (mFile, "%s\n", outStr.c_str ());
+    if (urgent || isFull ())
+        write ();
 
-    if (mSizeLimit != 0 && mSize > mSizeLimit)
-        roll ();
+    sbfMutex_unlock (&mMutex);
 }
 
 }
@@ -5,10 +5,13 @@
 #pragma once
 
 #include "logHandler.h"
+#include "logSegments.h"
 #include <string>
 
 using namespace std;
 
+struct z_stream_s;
+
 namespace neueda
 {
 
@@ -21,6 +24,49 @@ public:
     
     ~fileLogHandler ();
 
+    // lines are kept back until size bytes are pending, one at or above
+    // flushLevel arrives or flushInterval milliseconds pass. A size of 0
+    // writes every line, or batch, straight out. Call before setup
+    void setBuffer (size_t size,
+                    uint64_t flushInterval,
+                    logSeverity::level flushLevel);
+
+    // hand full buffers to a thread of the handler's own to write, the
+    // caller goes on filling a second buffer meanwhile and only waits
+    // when both are full. Call before setup
+    void setWriterThread (bool enabled) { mWriterThread = enabled; }
+
+    // append by copying into a shared mapping of the file rather than
+    // calling write. Each file is preallocated up to its size limit, or a
+    // mapping window at a time without one, and cut back to what was
+    // written when it is closed. A file whose space cannot be reserved
+    // is written instead. Call before setup
+    void setMapped (bool enabled) { mMapped = enabled; }
+
+    // name each file as it is opened instead of renaming the older ones
+    // on every roll, see logSegments. Closed files are gzipped when
+    // compress is set. Call before setup
+    void setNaming (logSegments::naming naming, bool compress)
+    {
+        mNaming = naming;
+        mCompress = compress;
+    }
+
+    // write gzip rather than plain text, ".gz" is added to every file
+    // name. Each buffer written out is a gzip member of its own, so a
+    // crash loses at most the one being written. Compressing is left to
+    // the writer thread, which this turns on. Call before setup
+    void setCompressed (bool enabled) { mCompressed = enabled; }
+
+    // also roll at every multiple of this many seconds since the epoch,
+    // so hourly and daily files line up with utc. A line past the end of
+    // the current period rolls to the period it falls in, and a file is
+    // closed on time even when nothing is logged across the boundary.
+    // Files are never reopened, a line stamped before the current period
+    // that arrives late goes to the current file. 0 rolls on size only.
+    // Call before setup
+    void setRotateInterval (uint64_t seconds) { mRotateInterval = seconds; }
+
     bool setup ();
 
     void teardown ();
@@ -31,16 +77,84 @@ public:
                  const char* message,
                  size_t message_len);
 
+    void handleBatch (const logBatchEntry* entries, size_t count);
+
+    // writes out what every buffered handler still open holds, also run
+    // when the process exits
+    static void flushAll ();
+
 private:
-    void flush ();
-    void roll ();
+    bool open (time_t start);
+    void closeFile ();
+    void roll (time_t start);
+    void rollRenaming ();
+    time_t periodOf (uint64_t time) const;
+    void rotateIfDue (uint64_t time);
+    void append (const logBatchEntry& entry);
+    bool isFull () const;
+    void write ();
+    void writeOut (const std::string& data);
+    void writeRaw (const char* data, size_t length);
+    bool deflateOut (const std::string& data);
+    size_t copyOut (const char* data, size_t length);
+    bool remap ();
+    uint64_t windowSize () const;
+    bool allocate (uint64_t length);
+
+    // sets the last error from the writing side, which on the writer
+    // thread runs without mMutex held
+    void ioError (const std::string& err);
+
+    // waits for the writer thread to write everything pending
+    void drain ();
+
+    void startThread ();
+    void stopThread ();
+    static void* threadCb (void* closure);
+    void flushOnTimer ();
+    void writeOnThread ();
+    void timedWait ();
 
-    FILE*               mFile;
+    int                 mFd;
     std::string         mPath;
-    size_t              mSize;
+    std::string         mCurrent;       // the file being written
+    logSegments::naming mNaming;
+    bool                mCompress;
+    logSegments*        mSegments;
+    bool                mCompressed;
+    std::string         mSuffix;        // after every file name
+    struct z_stream_s*  mDeflate;
+    std::string         mPacked;        // mBack once compressed
+    size_t              mSize;          // including lines not yet written
     size_t              mSizeLimit;
     int                 mCountLimit;
     int                 mCount;
+    std::string         mBuffer;        // lines not yet written
+    size_t              mBufferSize;
+    uint64_t            mFlushInterval;
+    logSeverity::level  mFlushLevel;
+    bool                mWriterThread;
+    std::string         mBack;          // being written by the writer
+    bool                mBackRoll;      // roll once mBack is written
+    time_t              mBackStart;     // period of the file rolled to
+    uint64_t            mRotateInterval;
+    uint64_t            mRotateAt;      // nanos, end of the current period
+    time_t              mPeriodStart;   // period lines are appended for
+    bool                mRollPending;   // roll at the next write
+    uint64_t            mOffset;        // writer's position in the file
+    bool                mMapped;
+    bool                mMapping;       // this file is written through mMap
+    char*               mMap;
+    uint64_t            mMapStart;      // file offset mMap starts at
+    uint64_t            mMapSize;       // length of mMap
+    uint64_t            mAllocated;     // bytes of the file preallocated
+    bool                mThreadRunning;
+    bool                mWriting;       // writer thread is out of mMutex
+    bool                mStopping;
+    sbfThread           mThread;
+    sbfCondVar          mCond;
+    sbfCondVar          mSpace;
+    sbfMutex            mMutex;
 };
 
 };
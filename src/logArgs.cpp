@@ -0,0 +1,470 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logArgs.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+namespace neueda
+{
+
+enum argType
+{
+    ARG_INVALID = 0,
+    ARG_PERCENT,
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_POINTER,
+    ARG_STRING
+};
+
+struct formatSpec
+{
+    const char* mStart;   // the '%' opening the conversion
+    size_t      mLength;  // length of the conversion including '%'
+    int         mStars;   // '*' width/precision arguments before the value
+    int         mPrecision; // -1 without one, from the last star if starred
+    bool        mStarPrecision;
+    argType     mType;
+};
+
+// longest conversion render will copy out of the format
+static const size_t kMaxSpecLength = 32;
+
+static bool
+isDigit (char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// parse the conversion at p, which points at a '%'
+static const char*
+parseSpec (const char* p, formatSpec& spec)
+{
+    spec.mStart = p;
+    spec.mStars = 0;
+    spec.mPrecision = -1;
+    spec.mStarPrecision = false;
+    spec.mType = ARG_INVALID;
+
+    p++;
+    if (*p == '%')
+    {
+        spec.mType = ARG_PERCENT;
+        spec.mLength = 2;
+        return p + 1;
+    }
+
+    // positional arguments cannot be replayed one at a time
+    const char* q = p;
+    while (isDigit (*q))
+        q++;
+    if (*q == '$')
+        goto parseSpecInvalid;
+
+    while (*p != '\0' && strchr ("-+ #0'I", *p) != NULL)
+        p++;
+
+    if (*p == '*')
+    {
+        spec.mStars++;
+        p++;
+    }
+    while (isDigit (*p))
+        p++;
+
+    if (*p == '.')
+    {
+        p++;
+        spec.mPrecision = 0;
+        if (*p == '*')
+        {
+            spec.mStars++;
+            spec.mStarPrecision = true;
+            p++;
+        }
+        while (isDigit (*p))
+        {
+            spec.mPrecision = spec.mPrecision * 10 + (*p - '0');
+            p++;
+        }
+    }
+
+    {
+        char length = 0;
+        switch (*p)
+        {
+        case 'h':
+            length = 'h';
+            p++;
+            if (*p == 'h')
+                p++;
+            break;
+        case 'l':
+            length = 'l';
+            p++;
+            if (*p == 'l')
+            {
+                length = 'q';
+                p++;
+            }
+            break;
+        case 'q':
+        case 'L':
+        case 'j':
+        case 'z':
+        case 'Z':
+        case 't':
+            length = *p;
+            p++;
+            break;
+        default:
+            break;
+        }
+
+        switch (*p)
+        {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (length)
+            {
+            case 'l':
+                spec.mType = ARG_LONG;
+                break;
+            case 'q':
+            case 'L':
+                spec.mType = ARG_LLONG;
+                break;
+            case 'j':
+                spec.mType = ARG_INTMAX;
+                break;
+            case 'z':
+            case 'Z':
+                spec.mType = ARG_SIZE;
+                break;
+            case 't':
+                spec.mType = ARG_PTRDIFF;
+                break;
+            default:
+                spec.mType = ARG_INT;
+                break;
+            }
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec.mType = length == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 'c':
+            if (length == 0)
+                spec.mType = ARG_INT;
+            break;
+        case 's':
+            if (length == 0)
+                spec.mType = ARG_STRING;
+            break;
+        case 'p':
+            spec.mType = ARG_POINTER;
+            break;
+        default:
+            // %n, %m, wide characters and anything unknown
+            break;
+        }
+    }
+
+    if (*p == '\0')
+        goto parseSpecInvalid;
+
+    p++;
+    spec.mLength = p - spec.mStart;
+    if (spec.mLength >= kMaxSpecLength)
+        spec.mType = ARG_INVALID;
+    return p;
+
+parseSpecInvalid:
+    spec.mType = ARG_INVALID;
+    spec.mLength = 0;
+    return p;
+}
+
+static bool
+put (char* buffer, size_t capacity, size_t& used, const void* v, size_t len)
+{
+    if (capacity - used < len)
+        return false;
+
+    memcpy (buffer + used, v, len);
+    used += len;
+    return true;
+}
+
+template <typename T>
+static bool
+putArg (char* buffer, size_t capacity, size_t& used, T value)
+{
+    return put (buffer, capacity, used, &value, sizeof value);
+}
+
+template <typename T>
+static bool
+takeArg (const char* buffer, size_t length, size_t& offset, T& value)
+{
+    if (length - offset < sizeof value)
+        return false;
+
+    memcpy (&value, buffer + offset, sizeof value);
+    offset += sizeof value;
+    return true;
+}
+
+bool
+logArgs::encode (const char* fmt,
+                 va_list ap,
+                 char* buffer,
+                 size_t capacity,
+                 size_t& length)
+{
+    size_t used = 0;
+    bool ok = true;
+
+    const char* p = fmt;
+    while (ok && *p != '\0')
+    {
+        if (*p != '%')
+        {
+            p++;
+            continue;
+        }
+
+        formatSpec spec;
+        p = parseSpec (p, spec);
+
+        for (int i = 0; ok && i < spec.mStars; i++)
+        {
+            int star = va_arg (ap, int);
+            // a negative precision is taken as none
+            if (spec.mStarPrecision && i == spec.mStars - 1)
+                spec.mPrecision = star < 0 ? -1 : star;
+            ok = putArg (buffer, capacity, used, star);
+        }
+
+        switch (spec.mType)
+        {
+        case ARG_PERCENT:
+            break;
+        case ARG_INT:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, int));
+            break;
+        case ARG_LONG:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, long));
+            break;
+        case ARG_LLONG:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, long long));
+            break;
+        case ARG_SIZE:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, size_t));
+            break;
+        case ARG_INTMAX:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, intmax_t));
+            break;
+        case ARG_PTRDIFF:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, ptrdiff_t));
+            break;
+        case ARG_DOUBLE:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, double));
+            break;
+        case ARG_LDOUBLE:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, long double));
+            break;
+        case ARG_POINTER:
+            ok = ok && putArg (buffer, capacity, used, va_arg (ap, void*));
+            break;
+        case ARG_STRING:
+        {
+            const char* s = va_arg (ap, const char*);
+            if (s == NULL)
+                s = "(null)";
+
+            // with a precision the string need not be terminated, nothing
+            // past it may be read
+            size_t len = spec.mPrecision < 0
+                ? strlen (s)
+                : strnlen (s, spec.mPrecision);
+            ok = ok
+                && put (buffer, capacity, used, s, len)
+                && putArg (buffer, capacity, used, '\0');
+            break;
+        }
+        default:
+            ok = false;
+            break;
+        }
+    }
+
+    length = used;
+    return ok;
+}
+
+template <typename T>
+static int
+formatOne (char* dst, size_t size, const char* conv, const int* stars, int nstars, T value)
+{
+    switch (nstars)
+    {
+    case 0:
+        return snprintf (dst, size, conv, value);
+    case 1:
+        return snprintf (dst, size, conv, stars[0], value);
+    default:
+        return snprintf (dst, size, conv, stars[0], stars[1], value);
+    }
+}
+
+template <typename T>
+static void
+appendOne (string& out, const char* conv, const int* stars, int nstars, T value)
+{
+    char local[128];
+
+    int n = formatOne (local, sizeof local, conv, stars, nstars, value);
+    if (n < 0)
+        return;
+
+    if ((size_t)n < sizeof local)
+    {
+        out.append (local, n);
+        return;
+    }
+
+    size_t offset = out.size ();
+    out.resize (offset + n + 1);
+    formatOne (&out[offset], n + 1, conv, stars, nstars, value);
+    out.resize (offset + n);
+}
+
+template <typename T>
+static bool
+replayOne (string& out,
+           const char* conv,
+           const int* stars,
+           int nstars,
+           const char* buffer,
+           size_t length,
+           size_t& offset)
+{
+    T value;
+    if (!takeArg (buffer, length, offset, value))
+        return false;
+
+    appendOne (out, conv, stars, nstars, value);
+    return true;
+}
+
+void
+logArgs::render (string& out,
+                 const char* fmt,
+                 const char* buffer,
+                 size_t length)
+{
+    size_t offset = 0;
+    bool ok = true;
+
+    const char* p = fmt;
+    while (ok && *p != '\0')
+    {
+        const char* literal = p;
+        while (*p != '\0' && *p != '%')
+            p++;
+        out.append (literal, p - literal);
+
+        if (*p == '\0')
+            break;
+
+        formatSpec spec;
+        p = parseSpec (p, spec);
+        if (spec.mType == ARG_PERCENT)
+        {
+            out.push_back ('%');
+            continue;
+        }
+        if (spec.mType == ARG_INVALID)
+            break;
+
+        char conv[kMaxSpecLength];
+        memcpy (conv, spec.mStart, spec.mLength);
+        conv[spec.mLength] = '\0';
+
+        int stars[2] = { 0, 0 };
+        for (int i = 0; ok && i < spec.mStars; i++)
+            ok = takeArg (buffer, length, offset, stars[i]);
+        if (!ok)
+            break;
+
+        switch (spec.mType)
+        {
+        case ARG_INT:
+            ok = replayOne<int> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_LONG:
+            ok = replayOne<long> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_LLONG:
+            ok = replayOne<long long> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_SIZE:
+            ok = replayOne<size_t> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_INTMAX:
+            ok = replayOne<intmax_t> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_PTRDIFF:
+            ok = replayOne<ptrdiff_t> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_DOUBLE:
+            ok = replayOne<double> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_LDOUBLE:
+            ok = replayOne<long double> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_POINTER:
+            ok = replayOne<void*> (out, conv, stars, spec.mStars, buffer, length, offset);
+            break;
+        case ARG_STRING:
+        {
+            const char* s = buffer + offset;
+            size_t n = strnlen (s, length - offset);
+            if (n == length - offset)
+            {
+                ok = false;
+                break;
+            }
+            offset += n + 1;
+            appendOne (out, conv, stars, spec.mStars, s);
+            break;
+        }
+        default:
+            ok = false;
+            break;
+        }
+    }
+}
+
+}
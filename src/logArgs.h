@@ -0,0 +1,43 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+namespace neueda
+{
+
+/*
+ * Binary capture of printf style arguments, used by the deferred
+ * formatting mode. encode walks the format string and copies each
+ * argument (strings by value) into a flat buffer, render later replays
+ * the same format against that buffer on the dispatch thread.
+ *
+ * The format pointer itself is not copied, it must outlive the record
+ * which holds for string literals. Conversions that cannot be replayed
+ * (%n, %m, wide strings, positional arguments) make encode fail so the
+ * caller can format eagerly instead.
+ */
+class logArgs
+{
+public:
+    static bool encode (const char* fmt,
+                        va_list ap,
+                        char* buffer,
+                        size_t capacity,
+                        size_t& length);
+
+    // appends the rendered message to out
+    static void render (string& out,
+                        const char* fmt,
+                        const char* buffer,
+                        size_t length);
+};
+
+};
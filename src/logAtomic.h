@@ -0,0 +1,60 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * The few atomic operations the public headers use inline, kept in one
+ * place so those headers do not spell out the gcc and clang __atomic
+ * builtins. The library itself is POSIX only and needs one of those two
+ * compilers.
+ */
+
+template <typename T>
+inline T
+logAtomic_loadRelaxed (const T* p)
+{
+    return __atomic_load_n (p, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+inline T
+logAtomic_loadAcquire (const T* p)
+{
+    return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void
+logAtomic_storeRelaxed (T* p, T value)
+{
+    __atomic_store_n (p, value, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+inline void
+logAtomic_storeRelease (T* p, T value)
+{
+    __atomic_store_n (p, value, __ATOMIC_RELEASE);
+}
+
+// returns the value before the add
+inline uint64_t
+logAtomic_fetchAdd (uint64_t* p, uint64_t value)
+{
+    return __atomic_fetch_add (p, value, __ATOMIC_RELAXED);
+}
+
+inline uint64_t
+logAtomic_exchange (uint64_t* p, uint64_t value)
+{
+    return __atomic_exchange_n (p, value, __ATOMIC_RELAXED);
+}
+
+}
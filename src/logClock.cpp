@@ -0,0 +1,216 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logClock.h"
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// how long the counter is timed against the wall clock when first selected
+static const useconds_t kCalibrationMicros = 10000;
+
+// how often conversions re-anchor the calibration
+static const uint64_t kResyncNanos = 1000000000;
+
+// readings taken for each calibration sample
+static const int kSampleTries = 5;
+
+namespace neueda
+{
+
+const uint64_t logClock::kTicks;
+
+volatile int logClock::mSource = logClock::CLOCK_SOURCE_REALTIME;
+
+volatile int64_t logClock::mMonotonicOffset = 0;
+
+/*
+ * Two calibrations, the one in use and the one being written, switched
+ * by publishing the index. Resyncs are a second apart so a reader never
+ * sees a slot rewritten under it.
+ */
+struct tscCalibration
+{
+    uint64_t    mTicks;
+    uint64_t    mNanos;
+    double      mNanosPerTick;
+    uint64_t    mResyncTicks;
+};
+
+static tscCalibration calibrations[2];
+static volatile unsigned int calibrationIndex = 0;
+static volatile int resyncing = 0;
+
+static bool
+tscIsInvariant ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (edx & (1 << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+// a tsc reading and the wall clock time it corresponds to, from the
+// tightest of a few tries so a preempted one does not skew it
+static void
+sample (uint64_t& ticks, uint64_t& nanos)
+{
+    uint64_t best = ~(uint64_t)0;
+    for (int i = 0; i < kSampleTries; i++)
+    {
+        uint64_t before = logClock::readTsc ();
+        uint64_t now = logClock::clockNanos (CLOCK_REALTIME);
+        uint64_t after = logClock::readTsc ();
+
+        if (after - before < best)
+        {
+            best = after - before;
+            ticks = before + (after - before) / 2;
+            nanos = now;
+        }
+    }
+}
+
+static void
+publish (uint64_t ticks, uint64_t nanos, double nanosPerTick)
+{
+    unsigned int next = calibrationIndex + 1;
+    tscCalibration& c = calibrations[next & 1];
+
+    c.mTicks = ticks;
+    c.mNanos = nanos;
+    c.mNanosPerTick = nanosPerTick;
+    c.mResyncTicks = ticks + (uint64_t)(kResyncNanos / nanosPerTick);
+
+    __atomic_store_n (&calibrationIndex, next, __ATOMIC_RELEASE);
+}
+
+static void
+calibrate ()
+{
+    uint64_t ticks;
+    uint64_t nanos;
+    sample (ticks, nanos);
+
+    usleep (kCalibrationMicros);
+
+    uint64_t laterTicks;
+    uint64_t laterNanos;
+    sample (laterTicks, laterNanos);
+
+    double nanosPerTick = 1.0;
+    if (laterTicks > ticks)
+        nanosPerTick = (double)(laterNanos - nanos) / (laterTicks - ticks);
+
+    publish (laterTicks, laterNanos, nanosPerTick);
+}
+
+bool
+logClock::setSource (source s)
+{
+    bool ok = true;
+
+    if (s == CLOCK_SOURCE_TSC)
+    {
+        if (tscIsInvariant ())
+            calibrate ();
+        else
+        {
+            s = CLOCK_SOURCE_REALTIME;
+            ok = false;
+        }
+    }
+    else if (s == CLOCK_SOURCE_MONOTONIC)
+    {
+        // fixed when selected, later steps of the wall clock are ignored
+        int64_t offset = clockNanos (CLOCK_REALTIME)
+            - clockNanos (CLOCK_MONOTONIC);
+        __atomic_store_n (&mMonotonicOffset, offset, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n (&mSource, s, __ATOMIC_RELEASE);
+    return ok;
+}
+
+void
+logClock::resync ()
+{
+    // one thread does it, the others carry on with the old calibration
+    if (__atomic_exchange_n (&resyncing, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    const tscCalibration& previous =
+        calibrations[__atomic_load_n (&calibrationIndex, __ATOMIC_ACQUIRE) & 1];
+
+    uint64_t ticks;
+    uint64_t nanos;
+    sample (ticks, nanos);
+
+    // the rate measured over the whole interval since the last anchor,
+    // unless it is too short to measure one better than the last
+    double nanosPerTick = previous.mNanosPerTick;
+    if (previous.mTicks != 0
+        && ticks > previous.mTicks
+        && nanos > previous.mNanos + kResyncNanos / 2)
+    {
+        nanosPerTick = (double)(nanos - previous.mNanos)
+            / (ticks - previous.mTicks);
+    }
+    publish (ticks, nanos, nanosPerTick);
+
+    __atomic_store_n (&resyncing, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t
+logClock::ticksToNanos (uint64_t ticks)
+{
+    const tscCalibration* c =
+        &calibrations[__atomic_load_n (&calibrationIndex, __ATOMIC_ACQUIRE) & 1];
+
+    if (ticks > c->mResyncTicks)
+    {
+        resync ();
+        c = &calibrations[__atomic_load_n (&calibrationIndex,
+                                           __ATOMIC_ACQUIRE) & 1];
+    }
+
+    int64_t delta = (int64_t)(ticks - c->mTicks);
+    return c->mNanos + (int64_t)(delta * c->mNanosPerTick);
+}
+
+bool
+logClock::parseSource (const string& value, source& s)
+{
+    if (value == "realtime")
+    {
+        s = CLOCK_SOURCE_REALTIME;
+        return true;
+    }
+    else if (value == "realtime-coarse")
+    {
+        s = CLOCK_SOURCE_REALTIME_COARSE;
+        return true;
+    }
+    else if (value == "monotonic")
+    {
+        s = CLOCK_SOURCE_MONOTONIC;
+        return true;
+    }
+    else if (value == "tsc")
+    {
+        s = CLOCK_SOURCE_TSC;
+        return true;
+    }
+
+    return false;
+}
+
+}
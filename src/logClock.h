@@ -0,0 +1,112 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include <string>
+#include <ctime>
+#include <stdint.h>
+
+using namespace std;
+
+namespace neueda
+{
+
+/*
+ * Where loggers get their timestamps from. Times handed to handlers are
+ * always nanoseconds since the epoch, but with the tsc source a logger
+ * only reads the cpu's time stamp counter and the conversion to wall
+ * clock time is left to whoever consumes the record, normally the async
+ * dispatch thread. Such raw readings are tagged with the top bit, so
+ * toNanos passes plain nanosecond times through untouched.
+ *
+ * The counter is calibrated against CLOCK_REALTIME when selected and
+ * re-anchored once a second by the consumer converting records. A change
+ * of source applies to records stamped after it; raw readings taken
+ * before stay convertible.
+ */
+class logClock
+{
+public:
+    enum source
+    {
+        CLOCK_SOURCE_REALTIME = 0,      // clock_gettime (CLOCK_REALTIME)
+        CLOCK_SOURCE_REALTIME_COARSE,   // cheaper, at tick resolution
+        CLOCK_SOURCE_MONOTONIC,         // immune to steps of the wall clock
+        CLOCK_SOURCE_TSC                // rdtsc, converted by the consumer
+    };
+
+    // hot path, the time for a record being logged now
+    static uint64_t now ()
+    {
+        switch (__atomic_load_n (&mSource, __ATOMIC_RELAXED))
+        {
+        case CLOCK_SOURCE_TSC:
+            return readTsc () | kTicks;
+        case CLOCK_SOURCE_REALTIME_COARSE:
+#ifdef CLOCK_REALTIME_COARSE
+            return clockNanos (CLOCK_REALTIME_COARSE);
+#else
+            return clockNanos (CLOCK_REALTIME);
+#endif
+        case CLOCK_SOURCE_MONOTONIC:
+            return clockNanos (CLOCK_MONOTONIC)
+                + __atomic_load_n (&mMonotonicOffset, __ATOMIC_RELAXED);
+        default:
+            return clockNanos (CLOCK_REALTIME);
+        }
+    }
+
+    // consumer side, nanoseconds since the epoch for a time from now ()
+    static uint64_t toNanos (uint64_t time)
+    {
+        if (!(time & kTicks))
+            return time;
+        return ticksToNanos (time & ~kTicks);
+    }
+
+    // false when the source is not available here, the realtime clock is
+    // used instead
+    static bool setSource (source s);
+
+    static source getSource ()
+    {
+        return static_cast<source>(__atomic_load_n (&mSource,
+                                                    __ATOMIC_RELAXED));
+    }
+
+    // anchor the tsc calibration at the current time
+    static void resync ();
+
+    static bool parseSource (const string& value, source& s);
+
+    static uint64_t clockNanos (clockid_t clock)
+    {
+        struct timespec ts;
+        clock_gettime (clock, &ts);
+        return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+    }
+
+    static uint64_t readTsc ()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int lo;
+        unsigned int hi;
+        __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+        return ((uint64_t)hi << 32) | lo;
+#else
+        return 0;
+#endif
+    }
+
+private:
+    static const uint64_t kTicks = 1ULL << 63;
+
+    static uint64_t ticksToNanos (uint64_t ticks);
+
+    static volatile int     mSource;
+    static volatile int64_t mMonotonicOffset;
+};
+
+};
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logEpoch.h"
+
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+
+// yields before a waiter starts to sleep
+static const unsigned int kYieldLimit = 64;
+
+namespace neueda
+{
+
+logEpoch::logEpoch () :
+    mEpoch (0)
+{
+    mReaders[0] = 0;
+    mReaders[1] = 0;
+}
+
+void
+logEpoch::synchronize ()
+{
+    // a reader counts itself in one epoch and then loads, so one that
+    // picked up the old value is counted in the current epoch or, if it
+    // read the epoch before the last flip, the one before. Flipping twice
+    // and draining the retired side each time covers both, while new
+    // readers always land on the side not being drained
+    for (int i = 0; i < 2; i++)
+    {
+        unsigned int epoch = __atomic_fetch_add (&mEpoch, 1, __ATOMIC_SEQ_CST);
+
+        unsigned int spins = 0;
+        while (__atomic_load_n (&mReaders[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+            backoff (spins);
+    }
+}
+
+void
+logEpoch::backoff (unsigned int& spins)
+{
+    if (spins < kYieldLimit)
+    {
+        spins++;
+        sched_yield ();
+        return;
+    }
+
+    // up to a millisecond at a time
+    unsigned int shift = std::min (spins++ - kYieldLimit, 10u);
+    usleep (1u << shift);
+}
+
+logEpoch::guard::guard (logEpoch& epoch)
+{
+    unsigned int current = __atomic_load_n (&epoch.mEpoch, __ATOMIC_SEQ_CST);
+    mReaders = &epoch.mReaders[current & 1];
+
+    __atomic_add_fetch (mReaders, 1, __ATOMIC_SEQ_CST);
+}
+
+logEpoch::guard::~guard ()
+{
+    __atomic_sub_fetch (mReaders, 1, __ATOMIC_RELEASE);
+}
+
+}
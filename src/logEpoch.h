@@ -0,0 +1,55 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+namespace neueda
+{
+
+/*
+ * Lets a writer wait until no reader can still be using something it
+ * has just unpublished. Readers never lock, a guard only bumps a counter
+ * for the epoch it entered in. synchronize flips the epoch twice and
+ * waits for each retired side to drain, so once it returns every guard
+ * that might have seen the old value is gone. Writers are serialised by
+ * the caller.
+ */
+class logEpoch
+{
+public:
+    logEpoch ();
+
+    // held for as long as the reader uses what it loaded after entering
+    class guard
+    {
+    public:
+        guard (logEpoch& epoch);
+
+        ~guard ();
+
+    private:
+        guard (const guard& that);
+        void operator= (const guard& that);
+
+        volatile int*   mReaders;
+    };
+
+    // wait until every guard entered before the call has left
+    void synchronize ();
+
+    // one round of waiting on another thread, yields at first and then
+    // sleeps for longer each time so a long wait costs little cpu
+    static void backoff (unsigned int& spins);
+
+private:
+    logEpoch (const logEpoch& that);
+    void operator= (const logEpoch& that);
+
+    char                        mPad0[64];
+    volatile unsigned int       mEpoch;
+    volatile int                mReaders[2];
+    char                        mPad1[64];
+};
+
+};
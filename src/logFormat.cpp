@@ -0,0 +1,191 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logFormat.h"
+
+#include "FormatScanner.h"
+#include "tokens.h"
+
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+// needed by flex
+int inscribe_FlexLexer::yywrap () { return 1; }
+
+namespace neueda
+{
+
+static const char*
+severityToChars (logSeverity::level severity)
+{
+    switch (severity)
+    {
+    case logSeverity::INFO:
+        return "INFO";
+    case logSeverity::WARN:
+        return "WARN";
+    case logSeverity::ERROR:
+        return "ERROR";
+    case logSeverity::DEBUG:
+        return "DEBUG";
+    case logSeverity::TRACE:
+        return "TRACE";
+    case logSeverity::FATAL:
+        return "FATAL";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static inline void
+writeTwoDigits (char* dst, unsigned int value)
+{
+    memcpy (dst, kDigitPairs + (value % 100) * 2, 2);
+}
+
+logTimestamp::logTimestamp () :
+    mSecond (0),
+    mValid (false)
+{
+    memset (mBuffer, 0, sizeof mBuffer);
+}
+
+void
+logTimestamp::append (string& out, uint64_t time)
+{
+    uint64_t second = time / 1000000000;
+    unsigned int nsec = time % 1000000000;
+
+    if (!mValid || second != mSecond)
+    {
+        // convert back to time objects for date time and calender
+        time_t t = second;
+        struct tm tm_time;
+        gmtime_r (&t, &tm_time);
+
+        unsigned int year = tm_time.tm_year + 1900;
+        writeTwoDigits (mBuffer, year / 100);
+        writeTwoDigits (mBuffer + 2, year);
+        mBuffer[4] = '-';
+        writeTwoDigits (mBuffer + 5, tm_time.tm_mon + 1);
+        mBuffer[7] = '-';
+        writeTwoDigits (mBuffer + 8, tm_time.tm_mday);
+        mBuffer[10] = ' ';
+        writeTwoDigits (mBuffer + 11, tm_time.tm_hour);
+        mBuffer[13] = ':';
+        writeTwoDigits (mBuffer + 14, tm_time.tm_min);
+        mBuffer[16] = ':';
+        writeTwoDigits (mBuffer + 17, tm_time.tm_sec);
+        mBuffer[19] = '.';
+
+        mSecond = second;
+        mValid = true;
+    }
+
+    writeTwoDigits (mBuffer + kPrefixLength, nsec / 10000000);
+    writeTwoDigits (mBuffer + kPrefixLength + 2, nsec / 100000);
+    writeTwoDigits (mBuffer + kPrefixLength + 4, nsec / 1000);
+    writeTwoDigits (mBuffer + kPrefixLength + 6, nsec / 10);
+    mBuffer[kPrefixLength + 8] = '0' + nsec % 10;
+
+    out.append (mBuffer, kLength);
+}
+
+logFormat::logFormat ()
+{
+}
+
+logFormat::logFormat (const string& format)
+{
+    compile (format);
+}
+
+void
+logFormat::compile (const string& format)
+{
+    mOps.clear ();
+    mLiterals.clear ();
+
+    // the lexer echoes everything that is not a token to its output stream,
+    // so whatever has accumulated there between two tokens is a literal
+    ostringstream oss;
+    istringstream iss (format);
+    yyFlexLexer lexer (&iss, &oss);
+
+    int yytoken = 0;
+    while ((yytoken = lexer.yylex ()) != 0)
+    {
+        appendLiteral (oss.str ());
+        oss.str ("");
+
+        formatOp op;
+        op.mToken = yytoken;
+        op.mOffset = 0;
+        op.mLength = 0;
+        mOps.push_back (op);
+    }
+    appendLiteral (oss.str ());
+}
+
+void
+logFormat::appendLiteral (const string& literal)
+{
+    if (literal.empty ())
+        return;
+
+    formatOp op;
+    op.mToken = 0;
+    op.mOffset = mLiterals.size ();
+    op.mLength = literal.size ();
+    mOps.push_back (op);
+
+    mLiterals.append (literal);
+}
+
+void
+logFormat::render (string& out,
+                   logSeverity::level severity,
+                   const char* name,
+                   uint64_t time,
+                   const char* message,
+                   size_t message_len)
+{
+    vector<formatOp>::const_iterator it;
+    for (it = mOps.begin (); it != mOps.end (); ++it)
+    {
+        switch (it->mToken)
+        {
+        case TIME:
+            mTimestamp.append (out, time);
+            break;
+        case SEVERITY:
+            out.append (severityToChars (severity));
+            break;
+        case NAME:
+            out.append (name);
+            break;
+        case MESSAGE:
+            out.append (message, message_len);
+            break;
+        default:
+            out.append (mLiterals, it->mOffset, it->mLength);
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logSeverity.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+namespace neueda
+{
+
+/*
+ * Renders the {time} token. The "YYYY-MM-DD HH:MM:SS." prefix is only
+ * rebuilt when the second changes, every other record just patches in
+ * the nanosecond digits. Not thread safe, each logFormat owns one.
+ */
+class logTimestamp
+{
+public:
+    logTimestamp ();
+
+    // appends "YYYY-MM-DD HH:MM:SS.nnnnnnnnn" for a time in nanos
+    void append (string& out, uint64_t time);
+
+private:
+    static const size_t kPrefixLength = 20;
+    static const size_t kLength = kPrefixLength + 9;
+
+    uint64_t    mSecond;
+    bool        mValid;
+    char        mBuffer[kLength];
+};
+
+/*
+ * A format string compiled into a flat list of literal/token operations.
+ * The lexer only runs in compile (), rendering a record walks the list and
+ * appends into a caller owned buffer, so once the buffer has grown to the
+ * size of a typical line no further allocation takes place.
+ */
+class logFormat
+{
+public:
+    logFormat ();
+
+    logFormat (const string& format);
+
+    void compile (const string& format);
+
+    // appends the formatted record to out
+    void render (string& out,
+                 logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len);
+
+private:
+    struct formatOp
+    {
+        int     mToken;   // 0 for a literal, otherwise a tokens.h value
+        size_t  mOffset;  // literal offset into mLiterals
+        size_t  mLength;  // literal length
+    };
+
+    void appendLiteral (const string& literal);
+
+    vector<formatOp>    mOps;
+    string              mLiterals;
+    logTimestamp        mTimestamp;
+};
+
+};
@@ -3,6 +3,7 @@
  */
 
 #include "logHandler.h"
+#include "logger.h"
 #include "fileLogHandler.h"
 #include "consoleLogHandler.h"
 #ifndef WIN32
@@ -10,9 +11,6 @@
 #include "sharedMemoryLogHandler.h"
 #endif
 
-#include "FormatScanner.h"
-#include "tokens.h"
-
 #include "utils.h"
 
 #include <cstdio>
@@ -27,75 +25,46 @@
 #define DEFAULT_LOG_LEVEL        "info"
 #define DEFAULT_LOG_SIZE         "0"
 #define DEFAULT_FILE_COUNT       "0"
+#define DEFAULT_BUFFER_SIZE      "0"
+#define DEFAULT_FLUSH_INTERVAL   "100"
+#define DEFAULT_FLUSH_LEVEL      "err"
+#define DEFAULT_FILE_NAMING      "rename"
+#define DEFAULT_ROTATE_INTERVAL  "0"
 #define DEFAULT_LOG_FORMAT       "{severity} {time} {name} {message}"
 
-// needed by flex
-int inscribe_FlexLexer::yywrap () { return 1; }
-
 namespace neueda
 {
 
 logHandler::logHandler () : 
     mLevel (logSeverity::INFO),
-    mFormat (DEFAULT_LOG_LEVEL)
+    mFormat (DEFAULT_LOG_LEVEL),
+    mFormatter (mFormat)
+{
+}
+
+void
+logHandler::setLevel (logSeverity::level severity)
 {
+    mLevel = severity;
+    logService::handlerLevelChanged ();
 }
 
 string
 logHandler::toString (const string& format,
                       logSeverity::level severity,
                       const char* name,
-		      uint64_t time,
+                      uint64_t time,
                       const char* message,
                       size_t message_len)
 {
-    ostringstream oss;
-    istringstream iss (format);
-    yyFlexLexer lexer (&iss, &oss);
-
-    int yytoken = 0;
-    while ((yytoken = lexer.yylex ()) != 0)
-    {
-        if (yytoken == TIME)
-        {
-            char dateTimeBuffer[64];
-            memset (dateTimeBuffer, 0, sizeof dateTimeBuffer);
-
-	    // convert back to time objects for date time and calender
-	    struct timeval tv;
-	    tv.tv_sec = time / 1000000;
-	    tv.tv_usec = time % 1000000;
-
-	    time_t t = tv.tv_sec;
-	    struct tm tm_time;
-	    gmtime_r (&t, &tm_time);
-
-	    size_t nBytes = snprintf (dateTimeBuffer,
-				      sizeof dateTimeBuffer,
-				      "%04u-%02u-%02u %02u:%02u:%02u.%06u",
-				      tm_time.tm_year + 1900,
-				      tm_time.tm_mon + 1,
-				      tm_time.tm_mday,
-				      tm_time.tm_hour,
-				      tm_time.tm_min,
-				      tm_time.tm_sec,
-				      (unsigned int)tv.tv_usec);
-            oss << string (dateTimeBuffer, nBytes);
-        }
-        else if (yytoken == SEVERITY)
-        {
-            oss << logHandler::severityToString (severity);
-        }
-        else if (yytoken == NAME)
-        {
-            oss << name;
-        }
-        else if (yytoken == MESSAGE)
-        {
-            oss << string (message, message_len);
-        }
-    }
-    return oss.str ();
+    string out;
+    logFormat (format).render (out,
+                               severity,
+                               name,
+                               time,
+                               message,
+                               message_len);
+    return out;
 }
 
 string
@@ -120,6 +89,23 @@ logHandler::severityToString (const logSeverity::level severity)
     }
 }
 
+void
+logHandler::handleBatch (const logBatchEntry* entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const logBatchEntry& entry = entries[i];
+        if (!isLevelEnabled (entry.mSeverity))
+            continue;
+
+        handle (entry.mSeverity,
+                entry.mName,
+                entry.mTime,
+                entry.mMessage,
+                entry.mMessageLen);
+    }
+}
+
 bool
 logHandler::isLevelEnabled (logSeverity::level level) const
 {
@@ -226,10 +212,19 @@ logHandlerFactory::configureFileHandler (properties& props,
     string format;
     string sizeLimit;
     string fileCount;
+    string bufferSize;
+    string flushInterval;
+    string flushLevel;
+    string naming;
+    string rotateInterval;
 
     props.get ("lh.file.format", DEFAULT_LOG_FORMAT, format);
     props.get ("lh.file.size", DEFAULT_LOG_SIZE, sizeLimit);
     props.get ("lh.file.count", DEFAULT_FILE_COUNT, fileCount);
+    props.get ("lh.file.buffer.size", DEFAULT_BUFFER_SIZE, bufferSize);
+    props.get ("lh.file.flush.interval", DEFAULT_FLUSH_INTERVAL, flushInterval);
+    props.get ("lh.file.flush.level", DEFAULT_FLUSH_LEVEL, flushLevel);
+    props.get ("lh.file.rotate.interval", DEFAULT_ROTATE_INTERVAL, rotateInterval);
 
     if (enabled)
     {
@@ -261,9 +256,87 @@ logHandlerFactory::configureFileHandler (properties& props,
             return false;
         }
 
+        int buffer = 0;
+        if (!utils_parseNumber (bufferSize, buffer) || buffer < 0)
+        {
+            errorMessage.assign ("failed to parse value for file.buffer.size");
+            return false;
+        }
+
+        int interval = 0;
+        if (!utils_parseNumber (flushInterval, interval) || interval < 0)
+        {
+            errorMessage.assign ("failed to parse value for file.flush.interval");
+            return false;
+        }
+
+        logSeverity::level flushSeverity;
+        if (!propertyValueToSeverity (flushLevel, flushSeverity, errorMessage))
+        {
+            errorMessage.assign ("failed to parse value for file.flush.level");
+            return false;
+        }
+
+        bool writerThread;
+        bool valid = true;
+        props.get ("lh.file.writer.thread", false, writerThread, valid);
+        if (!valid)
+        {
+            errorMessage.assign ("failed to parse value for file.writer.thread");
+            return false;
+        }
+
+        bool mapped;
+        props.get ("lh.file.mmap", false, mapped, valid);
+        if (!valid)
+        {
+            errorMessage.assign ("failed to parse value for file.mmap");
+            return false;
+        }
+
+        uint64_t rotateSeconds;
+        if (!propertyValueToInterval (rotateInterval, rotateSeconds, errorMessage))
+        {
+            errorMessage.assign ("failed to parse value for file.rotate.interval");
+            return false;
+        }
+
+        // files rotated on time are named by their period unless asked
+        if (!props.get ("lh.file.naming", naming))
+            naming = rotateSeconds != 0 ? "timestamp" : DEFAULT_FILE_NAMING;
+
+        logSegments::naming segmentNaming;
+        if (!logSegments::parseNaming (naming, segmentNaming))
+        {
+            errorMessage.assign ("failed to parse value for file.naming");
+            return false;
+        }
+
+        bool compress;
+        props.get ("lh.file.compress", false, compress, valid);
+        if (!valid)
+        {
+            errorMessage.assign ("failed to parse value for file.compress");
+            return false;
+        }
+
+        bool compressed;
+        props.get ("lh.file.compress.stream", false, compressed, valid);
+        if (!valid)
+        {
+            errorMessage.assign ("failed to parse value for file.compress.stream");
+            return false;
+        }
+
         fileLogHandler* handler = new fileLogHandler (path, size, fileCountLimit);
         handler->setLevel (logLevel);
         handler->setFormat (format);
+        handler->setBuffer (buffer, interval, flushSeverity);
+        handler->setWriterThread (writerThread);
+        handler->setMapped (mapped);
+        handler->setNaming (segmentNaming, compress);
+        handler->setRotateInterval (rotateSeconds);
+        handler->setCompressed (compressed);
         handlers.insert (handler);
     }
 
@@ -363,6 +436,33 @@ logHandlerFactory::propertyValueToConsoleFd (const string& value,
     return false;
 }
 
+bool
+logHandlerFactory::propertyValueToInterval (const string& value,
+                                            uint64_t& seconds,
+                                            string& errorMessage)
+{
+    if (value == "hourly")
+    {
+        seconds = 60 * 60;
+        return true;
+    }
+    else if (value == "daily")
+    {
+        seconds = 24 * 60 * 60;
+        return true;
+    }
+
+    int n = 0;
+    if (utils_parseNumber (value, n) && n >= 0)
+    {
+        seconds = n;
+        return true;
+    }
+
+    errorMessage.assign ("unable to parse interval from: " + value);
+    return false;
+}
+
 bool
 logHandlerFactory::propertyValueToSeverity (const string& value,
                                             logSeverity::level& severityValue,
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "logSeverity.h"
+#include "logFormat.h"
 #include "properties.h"
 #include <string>
 #include <set>
@@ -19,6 +20,16 @@ using namespace std;
 namespace neueda
 {
 
+// one record of a batch handed to logHandler::handleBatch
+struct logBatchEntry
+{
+    logSeverity::level  mSeverity;
+    const char*         mName;
+    uint64_t            mTime;          // nanoseconds since the epoch
+    const char*         mMessage;
+    size_t              mMessageLen;
+};
+
 class logHandler
 {
 public:
@@ -26,24 +37,35 @@ public:
 
     virtual ~logHandler() { }
     
-    virtual void setLevel (logSeverity::level severity) { mLevel = severity; }
+    // tells the service, a lower level may let more records through
+    virtual void setLevel (logSeverity::level severity);
 
     virtual logSeverity::level getLevel () const { return mLevel; }
 
     virtual const string& getFormat () const { return mFormat; }
 
-    virtual void setFormat (string& format) { mFormat = format; }
+    virtual void setFormat (string& format)
+    {
+        mFormat = format;
+        mFormatter.compile (mFormat);
+    }
 
     virtual bool setup () { return true; }
 
     virtual void teardown () { }
 
+    // time is nanoseconds since the epoch, whichever clock the service
+    // takes timestamps from
     virtual void handle (logSeverity::level severity,
                          const char* name,
                          uint64_t time,
                          const char* message,
                          size_t message_len) { }
 
+    // records delivered together by the async dispatcher, including ones
+    // below this handler's level which must be skipped
+    virtual void handleBatch (const logBatchEntry* entries, size_t count);
+
     virtual bool isLevelEnabled (logSeverity::level level) const;
 
     static string toString (const string& format,
@@ -62,6 +84,7 @@ public:
 protected:
     logSeverity::level  mLevel;
     string              mFormat;
+    logFormat           mFormatter;
     string              mError;
 };
 
@@ -72,6 +95,10 @@ public:
                                          bool& status,
                                          string& errorMessage);
 
+    static bool propertyValueToSeverity (const string& value,
+                                         logSeverity::level& boolValue,
+                                         string& errorMessage);
+
 private:
 
     static bool configureConsoleHandler (properties& properties,
@@ -95,8 +122,8 @@ private:
                                           FILE*& fdValue,
                                           string& errorMessage);
 
-    static bool propertyValueToSeverity (const string& value,
-                                         logSeverity::level& boolValue,
+    static bool propertyValueToInterval (const string& value,
+                                         uint64_t& seconds,
                                          string& errorMessage);
 
     static bool getHandlerEnabled (const properties& props,
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logHandlerSet.h"
+
+namespace neueda
+{
+
+// innermost reader on this thread, dispatch nests when a handler logs
+static __thread logHandlerSet::reader* tlsReader = NULL;
+
+logHandlerSet::logHandlerSet () :
+    mSnapshot (new snapshot (std::set<logHandler*> ()))
+{
+}
+
+logHandlerSet::~logHandlerSet ()
+{
+    unref (mSnapshot);
+}
+
+void
+logHandlerSet::publish (const std::set<logHandler*>& handlers)
+{
+    snapshot* previous =
+        __atomic_exchange_n (&mSnapshot, new snapshot (handlers), __ATOMIC_SEQ_CST);
+
+    // nobody takes a reference to previous from here on
+    mEpoch.synchronize ();
+
+    // called from a handler, this thread's own readers cannot be waited
+    // for, they stop walking it instead
+    int own = 0;
+    for (reader* r = tlsReader; r != NULL; r = r->mOuter)
+    {
+        if (r->mSnapshot == previous)
+            own++;
+    }
+    if (own > 0)
+        __atomic_store_n (&previous->mRetired, true, __ATOMIC_RELEASE);
+
+    unsigned int spins = 0;
+    while (__atomic_load_n (&previous->mRefs, __ATOMIC_ACQUIRE) != 1 + own)
+        logEpoch::backoff (spins);
+
+    unref (previous);
+}
+
+void
+logHandlerSet::unref (snapshot* s)
+{
+    if (__atomic_sub_fetch (&s->mRefs, 1, __ATOMIC_ACQ_REL) == 0)
+        delete s;
+}
+
+logHandlerSet::reader::reader (logHandlerSet& set)
+{
+    {
+        logEpoch::guard taking (set.mEpoch);
+
+        mSnapshot = __atomic_load_n (&set.mSnapshot, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch (&mSnapshot->mRefs, 1, __ATOMIC_SEQ_CST);
+    }
+
+    mOuter = tlsReader;
+    tlsReader = this;
+}
+
+logHandlerSet::reader::~reader ()
+{
+    tlsReader = mOuter;
+    unref (mSnapshot);
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logEpoch.h"
+#include "logHandler.h"
+
+#include <set>
+#include <vector>
+
+namespace neueda
+{
+
+/*
+ * The handlers the service dispatches to, published as an immutable
+ * snapshot. Readers never lock: under a logEpoch guard they take a
+ * counted reference to the snapshot and then walk it without the guard.
+ * Writers are serialized by the caller; publish swaps in a new snapshot,
+ * synchronizes so no reader is still taking a reference to the old one,
+ * and waits for the references held to be dropped, after which removed
+ * handlers are safe to tear down.
+ *
+ * A handler blocked in handle () holds up publish, and with it adding or
+ * removing handlers and configure. Handlers should not change the
+ * service themselves; if one does, publish only waits for the other
+ * threads, and the reader on the calling thread stops walking the old
+ * snapshot, see reader::isRetired.
+ */
+class logHandlerSet
+{
+    struct snapshot
+    {
+        snapshot (const std::set<logHandler*>& handlers) :
+            mHandlers (handlers.begin (), handlers.end ()),
+            mRefs (1),
+            mRetired (false)
+        {
+        }
+
+        std::vector<logHandler*>    mHandlers;
+        volatile int                mRefs;      // the set's and readers'
+        volatile bool               mRetired;
+    };
+
+public:
+    logHandlerSet ();
+
+    ~logHandlerSet ();
+
+    void publish (const std::set<logHandler*>& handlers);
+
+    class reader
+    {
+    public:
+        reader (logHandlerSet& set);
+
+        ~reader ();
+
+        size_t size () const { return mSnapshot->mHandlers.size (); }
+
+        logHandler* operator[] (size_t index) const
+        {
+            return mSnapshot->mHandlers[index];
+        }
+
+        // the set was changed from a handler called through this reader,
+        // the rest of the snapshot may have been torn down
+        bool isRetired () const { return mSnapshot->mRetired; }
+
+    private:
+        reader (const reader& that);
+        void operator= (const reader& that);
+
+        friend class logHandlerSet;
+
+        snapshot*       mSnapshot;
+        reader*         mOuter;     // next reader out on this thread
+    };
+
+private:
+    logHandlerSet (const logHandlerSet& that);
+    void operator= (const logHandlerSet& that);
+
+    static void unref (snapshot* s);
+
+    snapshot*                   mSnapshot;
+    logEpoch                    mEpoch;
+};
+
+};
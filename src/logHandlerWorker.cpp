@@ -0,0 +1,207 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logHandlerWorker.h"
+#include "logClock.h"
+
+#include <cstring>
+
+namespace neueda
+{
+
+logSharedBatch*
+logSharedBatch::create (const logBatchEntry* entries, size_t count)
+{
+    logSharedBatch* batch = new logSharedBatch ();
+
+    size_t text = 0;
+    for (size_t i = 0; i < count; i++)
+        text += strlen (entries[i].mName) + 1 + entries[i].mMessageLen + 1;
+
+    // sized up front so the entries can point straight into it
+    batch->mText.reserve (text);
+    batch->mEntries.assign (entries, entries + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        logBatchEntry& entry = batch->mEntries[i];
+
+        size_t position = batch->mText.size ();
+        batch->mText.append (entry.mName);
+        batch->mText.push_back ('\0');
+        entry.mName = batch->mText.data () + position;
+
+        position = batch->mText.size ();
+        batch->mText.append (entry.mMessage, entry.mMessageLen);
+        batch->mText.push_back ('\0');
+        entry.mMessage = batch->mText.data () + position;
+    }
+
+    return batch;
+}
+
+logHandlerWorker::logHandlerWorker (logHandler* handler,
+                                    size_t capacity,
+                                    logOverflow::policy overflow) :
+    mHandler (handler),
+    mCapacity (capacity),
+    mOverflow (overflow, logSeverity::FATAL),
+    mDepth (0),
+    mStopping (false),
+    mRunning (false)
+{
+    sbfMutex_init (&mMutex, 0);
+    sbfCondVar_init (&mReady);
+    sbfCondVar_init (&mSpace);
+}
+
+logHandlerWorker::~logHandlerWorker ()
+{
+    stop ();
+
+    sbfCondVar_destroy (&mSpace);
+    sbfCondVar_destroy (&mReady);
+    sbfMutex_destroy (&mMutex);
+}
+
+bool
+logHandlerWorker::start ()
+{
+    mStopping = false;
+    mRunning = sbfThread_create (&mThread, logHandlerWorker::run, this) == 0;
+    return mRunning;
+}
+
+void
+logHandlerWorker::stop ()
+{
+    if (!mRunning)
+        return;
+
+    sbfMutex_lock (&mMutex);
+    mStopping = true;
+    sbfCondVar_signal (&mReady);
+    sbfMutex_unlock (&mMutex);
+
+    sbfThread_join (mThread);
+    mRunning = false;
+}
+
+bool
+logHandlerWorker::post (logSharedBatch* batch)
+{
+    pending p = { batch, logClock::clockNanos (CLOCK_MONOTONIC) };
+
+    sbfMutex_lock (&mMutex);
+
+    // a batch larger than the whole queue still goes in once it is empty
+    while (mDepth > 0 && mDepth + batch->size () > mCapacity)
+    {
+        if (mOverflow.getPolicy () != logOverflow::OVERFLOW_BLOCK)
+        {
+            sbfMutex_unlock (&mMutex);
+            mOverflow.dropped (batch->size ());
+            return false;
+        }
+        sbfCondVar_wait (&mSpace, &mMutex);
+    }
+
+    batch->ref ();
+    mQueue.push_back (p);
+    mDepth += batch->size ();
+
+    sbfCondVar_signal (&mReady);
+    sbfMutex_unlock (&mMutex);
+
+    return true;
+}
+
+void
+logHandlerWorker::handle (logSeverity::level severity,
+                          const char* name,
+                          uint64_t time,
+                          const char* message,
+                          size_t message_len)
+{
+    logBatchEntry entry = { severity, name, time, message, message_len };
+    handleBatch (&entry, 1);
+}
+
+void
+logHandlerWorker::handleBatch (const logBatchEntry* entries, size_t count)
+{
+    logSharedBatch* batch = logSharedBatch::create (entries, count);
+    post (batch);
+    batch->unref ();
+}
+
+size_t
+logHandlerWorker::getDepth ()
+{
+    sbfMutex_lock (&mMutex);
+    size_t depth = mDepth;
+    sbfMutex_unlock (&mMutex);
+
+    return depth;
+}
+
+uint64_t
+logHandlerWorker::takeUnreported ()
+{
+    sbfMutex_lock (&mMutex);
+    uint64_t count = mOverflow.takeUnreported (mOverflow.getDropped ());
+    sbfMutex_unlock (&mMutex);
+
+    return count;
+}
+
+uint64_t
+logHandlerWorker::getLag ()
+{
+    uint64_t lag = 0;
+
+    sbfMutex_lock (&mMutex);
+    if (!mQueue.empty ())
+    {
+        uint64_t now = logClock::clockNanos (CLOCK_MONOTONIC);
+        if (now > mQueue.front ().mPosted)
+            lag = now - mQueue.front ().mPosted;
+    }
+    sbfMutex_unlock (&mMutex);
+
+    return lag;
+}
+
+void*
+logHandlerWorker::run (void* closure)
+{
+    logHandlerWorker* self = static_cast<logHandlerWorker*>(closure);
+
+    sbfMutex_lock (&self->mMutex);
+    for (;;)
+    {
+        while (self->mQueue.empty () && !self->mStopping)
+            sbfCondVar_wait (&self->mReady, &self->mMutex);
+        if (self->mQueue.empty ())
+            break;
+
+        // the batch stays queued while it is handled so it counts towards
+        // depth and lag until it is done
+        logSharedBatch* batch = self->mQueue.front ().mBatch;
+        sbfMutex_unlock (&self->mMutex);
+
+        size_t size = batch->size ();
+        self->mHandler->handleBatch (batch->getEntries (), size);
+        batch->unref ();
+
+        sbfMutex_lock (&self->mMutex);
+        self->mQueue.pop_front ();
+        self->mDepth -= size;
+        sbfCondVar_signal (&self->mSpace);
+    }
+    sbfMutex_unlock (&self->mMutex);
+
+    return NULL;
+}
+
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logHandler.h"
+#include "logOverflow.h"
+#include "sbfCommon.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * A batch of records copied once out of the async queue and shared by
+ * reference between the handler workers, the last one to finish with it
+ * frees it.
+ */
+class logSharedBatch
+{
+public:
+    static logSharedBatch* create (const logBatchEntry* entries, size_t count);
+
+    void ref ()
+    {
+        __atomic_add_fetch (&mRefs, 1, __ATOMIC_RELAXED);
+    }
+
+    void unref ()
+    {
+        if (__atomic_sub_fetch (&mRefs, 1, __ATOMIC_ACQ_REL) == 0)
+            delete this;
+    }
+
+    const logBatchEntry* getEntries () const { return &mEntries[0]; }
+
+    size_t size () const { return mEntries.size (); }
+
+private:
+    logSharedBatch () : mRefs (1) { }
+
+    std::vector<logBatchEntry>  mEntries;
+    std::string                 mText;
+    volatile int                mRefs;
+};
+
+/*
+ * Runs one handler on a thread of its own, fed batches by the service's
+ * dispatcher, so a slow sink only holds up its own queue. It stands in for
+ * the handler in the service's published handler set; setup and teardown
+ * of the wrapped handler stay with the service.
+ *
+ * The queue holds at most capacity records. When it is full the batch is
+ * dropped and counted with the drop-newest policy, so a stalled handler
+ * never holds up the dispatcher, or the dispatcher waits with block.
+ */
+class logHandlerWorker : public logHandler
+{
+public:
+    logHandlerWorker (logHandler* handler,
+                      size_t capacity,
+                      logOverflow::policy overflow);
+
+    ~logHandlerWorker ();
+
+    bool start ();
+
+    // hand every queued record to the handler, then join the thread
+    void stop ();
+
+    logHandler* getHandler () const { return mHandler; }
+
+    // false when the queue was full and the batch dropped
+    bool post (logSharedBatch* batch);
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len);
+
+    void handleBatch (const logBatchEntry* entries, size_t count);
+
+    bool isLevelEnabled (logSeverity::level level) const
+    {
+        return mHandler->isLevelEnabled (level);
+    }
+
+    // records waiting for the handler
+    size_t getDepth ();
+
+    // nanoseconds the oldest waiting batch has been queued, 0 when idle
+    uint64_t getLag ();
+
+    uint64_t getDropped () const { return mOverflow.getDropped (); }
+
+    // drops not yet reported, dispatchers may call it concurrently
+    uint64_t takeUnreported ();
+
+private:
+    logHandlerWorker (const logHandlerWorker& that);
+    void operator= (const logHandlerWorker& that);
+
+    struct pending
+    {
+        logSharedBatch* mBatch;
+        uint64_t        mPosted;
+    };
+
+    static void* run (void* closure);
+
+    logHandler*         mHandler;
+    size_t              mCapacity;
+    logOverflow         mOverflow;
+
+    sbfThread           mThread;
+    sbfMutex            mMutex;
+    sbfCondVar          mReady;
+    sbfCondVar          mSpace;
+    std::deque<pending> mQueue;
+    size_t              mDepth;
+    bool                mStopping;
+    bool                mRunning;
+};
+
+};
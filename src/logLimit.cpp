@@ -0,0 +1,46 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logLimit.h"
+#include "logClock.h"
+
+static const uint64_t kNanosPerSecond = 1000000000ULL;
+
+namespace neueda
+{
+
+bool
+logRateLimit::admit (uint64_t& suppressed)
+{
+    uint64_t now = logClock::clockNanos (CLOCK_MONOTONIC);
+    uint64_t interval = mRate > 0 ? kNanosPerSecond / mRate : 0;
+    uint64_t burst = mBurst > 0 ? mBurst : 1;
+
+    // each record moves mNext on by one interval, a record is turned away
+    // while that would put it a full bucket ahead of now
+    uint64_t next = __atomic_load_n (&mNext, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        uint64_t start = next > now ? next : now;
+        if (mRate == 0 || start - now > interval * (burst - 1))
+        {
+            __atomic_add_fetch (&mSuppressed, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        if (__atomic_compare_exchange_n (&mNext,
+                                         &next,
+                                         start + interval,
+                                         true,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED))
+            break;
+        // next was reloaded by the failed exchange
+    }
+
+    suppressed = __atomic_exchange_n (&mSuppressed, 0, __ATOMIC_RELAXED);
+    return true;
+}
+
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logAtomic.h"
+
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * Call site state behind the LOG_*_EVERY_N, LOG_*_FIRST_N and LOG_*_RATE
+ * macros, each call site keeps one in static storage. Both are aggregates
+ * so a static with constant limits is set up at load time rather than on
+ * first use, and admit is lock free. When a record is let through,
+ * suppressed is set to the number turned away since the last one was.
+ */
+
+// the first mFirst records, then one in every mEvery, or none with 0
+struct logSampler
+{
+    uint64_t    mFirst;
+    uint64_t    mEvery;
+    uint64_t    mCount;
+    uint64_t    mSuppressed;
+
+    bool admit (uint64_t& suppressed)
+    {
+        uint64_t n = logAtomic_fetchAdd (&mCount, 1);
+        if (n >= mFirst && (mEvery == 0 || (n - mFirst) % mEvery != mEvery - 1))
+        {
+            logAtomic_fetchAdd (&mSuppressed, 1);
+            return false;
+        }
+
+        suppressed = logAtomic_exchange (&mSuppressed, 0);
+        return true;
+    }
+};
+
+// a token bucket, mRate records a second with bursts of up to mBurst
+struct logRateLimit
+{
+    uint64_t    mRate;
+    uint64_t    mBurst;
+    uint64_t    mNext;          // when the bucket has a token for sure
+    uint64_t    mSuppressed;
+
+    bool admit (uint64_t& suppressed);
+};
+
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logOverflow.h"
+
+namespace neueda
+{
+
+logOverflow::logOverflow (policy p, logSeverity::level level) :
+    mPolicy (p),
+    mLevel (level),
+    mDropped (0),
+    mShed (false),
+    mReported (0)
+{
+}
+
+uint64_t
+logOverflow::takeUnreported (uint64_t dropped)
+{
+    if (dropped <= mReported)
+        return 0;
+
+    uint64_t count = dropped - mReported;
+    mReported = dropped;
+    return count;
+}
+
+bool
+logOverflow::parsePolicy (const string& value, policy& p)
+{
+    if (value == "block")
+    {
+        p = OVERFLOW_BLOCK;
+        return true;
+    }
+    else if (value == "drop-newest")
+    {
+        p = OVERFLOW_DROP_NEWEST;
+        return true;
+    }
+    else if (value == "drop-oldest")
+    {
+        p = OVERFLOW_DROP_OLDEST;
+        return true;
+    }
+    else if (value == "drop-below-severity")
+    {
+        p = OVERFLOW_DROP_BELOW_SEVERITY;
+        return true;
+    }
+
+    return false;
+}
+
+}
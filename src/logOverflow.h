@@ -0,0 +1,125 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logSeverity.h"
+
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+namespace neueda
+{
+
+/*
+ * What an async backend does when a producer finds it full, shared by the
+ * queue and the staging rings, along with the count of records dropped.
+ *
+ * Dropping the oldest records is done by the consumer: the producer
+ * notes how many bytes it is short of, asks for a shed and waits, the
+ * consumer then discards the oldest records until that much is free,
+ * and at least one record, rather than handing them to the handlers.
+ */
+class logOverflow
+{
+public:
+    enum policy
+    {
+        OVERFLOW_BLOCK = 0,             // wait for the consumer
+        OVERFLOW_DROP_NEWEST,           // drop the record being logged
+        OVERFLOW_DROP_OLDEST,           // discard what is queued for room
+        OVERFLOW_DROP_BELOW_SEVERITY    // drop below a level, else wait
+    };
+
+    logOverflow (policy p, logSeverity::level level);
+
+    policy getPolicy () const { return mPolicy; }
+
+    logSeverity::level getLevel () const { return mLevel; }
+
+    // producer side, the backend is full and short of wanted bytes,
+    // noted in shedWanted for drop-oldest. True when the record is to be
+    // dropped, otherwise the producer waits and tries again
+    bool onFull (logSeverity::level severity,
+                 volatile uint64_t& shedWanted,
+                 uint64_t wanted)
+    {
+        switch (mPolicy)
+        {
+        case OVERFLOW_DROP_NEWEST:
+            dropped (1);
+            return true;
+        case OVERFLOW_DROP_BELOW_SEVERITY:
+            if (severity < mLevel)
+            {
+                dropped (1);
+                return true;
+            }
+            return false;
+        case OVERFLOW_DROP_OLDEST:
+        {
+            // the most any waiting producer is short of
+            uint64_t current = __atomic_load_n (&shedWanted, __ATOMIC_RELAXED);
+            while (current < wanted
+                   && !__atomic_compare_exchange_n (&shedWanted,
+                                                    &current,
+                                                    wanted,
+                                                    true,
+                                                    __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED))
+                ;
+            __atomic_store_n (&mShed, true, __ATOMIC_RELEASE);
+            return false;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // consumer side, whether a producer asked for the queue to be shed
+    bool takeShed ()
+    {
+        if (!__atomic_load_n (&mShed, __ATOMIC_ACQUIRE))
+            return false;
+        __atomic_store_n (&mShed, false, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    void dropped (uint64_t count)
+    {
+        __atomic_add_fetch (&mDropped, count, __ATOMIC_RELAXED);
+    }
+
+    uint64_t getDropped () const
+    {
+        return __atomic_load_n (&mDropped, __ATOMIC_RELAXED);
+    }
+
+    // consumer side, the bytes noted by onFull, cleared for the next
+    static uint64_t takeWanted (volatile uint64_t& shedWanted)
+    {
+        return __atomic_exchange_n (&shedWanted, 0, __ATOMIC_ACQ_REL);
+    }
+
+    // consumer side, drops since the last call counted up to a total
+    // previously read from getDropped
+    uint64_t takeUnreported (uint64_t dropped);
+
+    static bool parsePolicy (const string& value, policy& p);
+
+private:
+    policy              mPolicy;
+    logSeverity::level  mLevel;
+
+    char                mPad0[64];
+    volatile uint64_t   mDropped;
+    volatile bool       mShed;
+    char                mPad1[64];
+
+    uint64_t            mReported;
+};
+
+};
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logQueue.h"
+#include "logger.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace neueda
+{
+
+logQueue::logQueue (size_t size,
+                    size_t capacity,
+                    logWaiter::strategy strategy,
+                    logOverflow::policy overflow,
+                    logSeverity::level dropBelow) :
+    mBuffer (NULL),
+    mSize (1),
+    mMask (0),
+    mCapacity (capacity),
+    mHead (0),
+    mTail (0),
+    mQueued (0),
+    mRead (0),
+    mTaken (0),
+    mWaiter (strategy),
+    mOverflow (overflow, dropBelow),
+    mShedWanted (0)
+{
+    if (size < minSize ())
+        size = minSize ();
+    while (mSize < size)
+        mSize <<= 1;
+    mMask = mSize - 1;
+
+    void* mem = NULL;
+    if (posix_memalign (&mem, 64, mSize) != 0)
+        abort ();
+    memset (mem, 0, mSize);
+    mBuffer = static_cast<char*>(mem);
+}
+
+logQueue::~logQueue ()
+{
+    free (mBuffer);
+}
+
+size_t
+logQueue::minSize ()
+{
+    // room for a few records of deferred arguments
+    return 4 * logRecord::sizeFor (logRecord::kMaxNameLength,
+                                   defaultLogMessageChunkSize);
+}
+
+logRecord*
+logQueue::claim (size_t length, logSeverity::level severity)
+{
+    unsigned int spins = 0;
+    while (__atomic_add_fetch (&mQueued, 1, __ATOMIC_RELAXED) > mCapacity)
+    {
+        // too many records queued, wait for the consumer
+        __atomic_sub_fetch (&mQueued, 1, __ATOMIC_RELAXED);
+        // short of a record rather than of bytes, one will do
+        if (mOverflow.onFull (severity, mShedWanted, 0))
+            return NULL;
+        mWaiter.backoff (spins);
+    }
+
+    spins = 0;
+    uint64_t head = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+    size_t pad;
+    for (;;)
+    {
+        // a record never straddles the end of the ring, whoever would is
+        // also given the rest of it to fill with a pad
+        size_t offset = head & mMask;
+        pad = (offset + length > mSize) ? mSize - offset : 0;
+
+        uint64_t tail = __atomic_load_n (&mTail, __ATOMIC_ACQUIRE);
+        if (head + pad + length - tail > mSize)
+        {
+            // full, wait for the consumer to free space
+            if (mOverflow.onFull (severity,
+                                  mShedWanted,
+                                  head + pad + length - tail - mSize))
+            {
+                __atomic_sub_fetch (&mQueued, 1, __ATOMIC_RELAXED);
+                return NULL;
+            }
+            mWaiter.backoff (spins);
+            head = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n (&mHead,
+                                         &head,
+                                         head + pad + length,
+                                         true,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED))
+            break;
+        // head was reloaded by the failed exchange
+    }
+
+    if (pad > 0)
+    {
+        logRecord::pad (mBuffer + (head & mMask), pad);
+        head += pad;
+    }
+    return reinterpret_cast<logRecord*>(mBuffer + (head & mMask));
+}
+
+void
+logQueue::publish (logRecord* record, size_t claimed, size_t length)
+{
+    if (length < claimed)
+        logRecord::pad (reinterpret_cast<char*>(record) + length,
+                        claimed - length);
+
+    __atomic_store_n (&record->mLength, length, __ATOMIC_RELEASE);
+    mWaiter.notify ();
+}
+
+void
+logQueue::abandon (logRecord* record, size_t claimed)
+{
+    __atomic_sub_fetch (&mQueued, 1, __ATOMIC_RELAXED);
+
+    logRecord::pad (reinterpret_cast<char*>(record), claimed);
+    mWaiter.notify ();
+}
+
+bool
+logQueue::isReady () const
+{
+    const logRecord* record =
+        reinterpret_cast<const logRecord*>(mBuffer + (mRead & mMask));
+    return __atomic_load_n (&record->mLength, __ATOMIC_ACQUIRE) != 0;
+}
+
+const logRecord*
+logQueue::peek ()
+{
+    for (;;)
+    {
+        const logRecord* record =
+            reinterpret_cast<const logRecord*>(mBuffer + (mRead & mMask));
+
+        uint32_t length = __atomic_load_n (&record->mLength, __ATOMIC_ACQUIRE);
+        if (length == 0)
+            return NULL;
+
+        if (!(record->mFlags & logRecord::RECORD_PAD))
+            return record;
+
+        mRead += length;
+    }
+}
+
+const logRecord*
+logQueue::take ()
+{
+    unsigned int spins = 0;
+    for (;;)
+    {
+        if (mOverflow.takeShed ())
+            shed ();
+
+        const logRecord* record = peek ();
+        if (record != NULL)
+            return record;
+
+        // a record may be claimed but not yet published
+        if (mWaiter.isStopped ()
+            && __atomic_load_n (&mHead, __ATOMIC_ACQUIRE) == mRead)
+            return NULL;
+
+        mWaiter.idle (spins, *this);
+    }
+}
+
+void
+logQueue::release ()
+{
+    const logRecord* record =
+        reinterpret_cast<const logRecord*>(mBuffer + (mRead & mMask));
+    mRead += record->mLength;
+    mTaken++;
+
+    commit ();
+}
+
+size_t
+logQueue::takeBatch (const logRecord** records, size_t max)
+{
+    const logRecord* record = take ();
+    if (record == NULL)
+        return 0;
+
+    size_t count = 0;
+    do
+    {
+        records[count++] = record;
+        mRead += record->mLength;
+        mTaken++;
+    } while (count < max && (record = peek ()) != NULL);
+
+    return count;
+}
+
+void
+logQueue::releaseBatch ()
+{
+    commit ();
+}
+
+void
+logQueue::commit ()
+{
+    uint64_t tail = mTail;
+    if (tail == mRead)
+        return;
+
+    // the read span may wrap around the end of the ring
+    size_t offset = tail & mMask;
+    size_t length = mRead - tail;
+    if (offset + length > mSize)
+    {
+        memset (mBuffer + offset, 0, mSize - offset);
+        memset (mBuffer, 0, offset + length - mSize);
+    }
+    else
+        memset (mBuffer + offset, 0, length);
+
+    __atomic_store_n (&mTail, mRead, __ATOMIC_RELEASE);
+    __atomic_sub_fetch (&mQueued, mTaken, __ATOMIC_RELAXED);
+    mTaken = 0;
+}
+
+void
+logQueue::shed ()
+{
+    uint64_t wanted = logOverflow::takeWanted (mShedWanted);
+    uint64_t from = mRead;
+    uint64_t count = 0;
+    const logRecord* record;
+    while ((count == 0 || mRead - from < wanted)
+           && (record = peek ()) != NULL)
+    {
+        mRead += record->mLength;
+        mTaken++;
+        count++;
+    }
+
+    commit ();
+    mOverflow.dropped (count);
+}
+
+void
+logQueue::stop ()
+{
+    mWaiter.stop ();
+}
+
+}
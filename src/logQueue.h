@@ -0,0 +1,117 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logOverflow.h"
+#include "logRecord.h"
+#include "logWaiter.h"
+
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * Bounded multi-producer/single-consumer byte ring of variable length
+ * records, limited both in bytes and in the number of records queued.
+ *
+ * Producers reserve space with a CAS on the head position, build the
+ * record in place and publish it by storing its length. The consumer
+ * reads records strictly in reservation order, so records from one
+ * producer come out in the order they went in, and zeroes consumed space
+ * before handing it back so an unpublished record always reads as length
+ * 0. No locks are taken on the producer side unless the consumer is
+ * parked under logWaiter::WAIT_BLOCK. What happens when it is full is up
+ * to the logOverflow policy.
+ */
+class logQueue
+{
+public:
+    logQueue (size_t size,
+              size_t capacity,
+              logWaiter::strategy strategy,
+              logOverflow::policy overflow = logOverflow::OVERFLOW_BLOCK,
+              logSeverity::level dropBelow = logSeverity::WARN);
+
+    ~logQueue ();
+
+    // producer side, room for a record of length bytes. While the ring is
+    // full it blocks, or returns NULL when the overflow policy drops the
+    // record. length must not exceed maxRecordSize ()
+    logRecord* claim (size_t length, logSeverity::level severity);
+
+    // make a claimed record visible, length may be less than claimed
+    void publish (logRecord* record, size_t claimed, size_t length);
+
+    // hand back a claimed record without publishing anything
+    void abandon (logRecord* record, size_t claimed);
+
+    // consumer side, returns NULL once stopped and drained
+    const logRecord* take ();
+
+    void release ();
+
+    // consumer side, waits for at least one record then takes every
+    // published record behind it up to max, returns 0 once stopped and
+    // drained. The records stay valid until releaseBatch
+    size_t takeBatch (const logRecord** records, size_t max);
+
+    void releaseBatch ();
+
+    void stop ();
+
+    size_t getSize () const { return mSize; }
+
+    size_t getCapacity () const { return mCapacity; }
+
+    size_t maxRecordSize () const { return mSize / 4; }
+
+    static size_t minSize ();
+
+    logWaiter::strategy getWaitStrategy () const
+    {
+        return mWaiter.getStrategy ();
+    }
+
+    logOverflow& getOverflow () { return mOverflow; }
+
+    // whether a record is published at the read position, for logWaiter
+    bool isReady () const;
+
+private:
+    logQueue (const logQueue& that);
+    void operator= (const logQueue& that);
+
+    // next published record at mRead, skipping pads, or NULL
+    const logRecord* peek ();
+
+    // zero what was read and hand it back to the producers
+    void commit ();
+
+    // discard the oldest records for drop-oldest, as many as producers
+    // need room for
+    void shed ();
+
+    char*               mBuffer;
+    size_t              mSize;
+    size_t              mMask;
+    size_t              mCapacity;
+
+    char                mPad0[64];
+    volatile uint64_t   mHead;
+    char                mPad1[64];
+    volatile uint64_t   mTail;
+    volatile size_t     mQueued;
+    char                mPad2[64];
+    uint64_t            mRead;
+    size_t              mTaken;
+    char                mPad3[64];
+
+    logWaiter           mWaiter;
+    logOverflow         mOverflow;
+    volatile uint64_t   mShedWanted;    // bytes short, for drop-oldest
+};
+
+};
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logSeverity.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * Length prefixed record as laid out in the byte rings. The header is
+ * followed by the nul terminated logger name and then the message, which
+ * holds logArgs encoded arguments instead of text when mFormat is set.
+ * In process the logger is identified by its logRegistry id and the name
+ * is left empty; it is only copied in when there is no id, as for records
+ * crossing to another process.
+ * Records are padded to 8 bytes so headers stay aligned in the ring.
+ *
+ * mLength is written last by whoever publishes the record; a pad record
+ * only needs mLength and mFlags, which share the first 8 bytes.
+ */
+struct logRecord
+{
+    enum flags
+    {
+        RECORD_PAD = 1  // filler, skip it
+    };
+
+    // longer logger names are truncated
+    static const size_t kMaxNameLength = 255;
+
+    uint32_t    mLength;      // whole record including header and padding
+    uint16_t    mNameLen;
+    uint8_t     mSeverity;
+    uint8_t     mFlags;
+    uint32_t    mMessageLen;
+    uint32_t    mLoggerId;
+    uint64_t    mTime;
+    const char* mFormat;
+
+    char* getName () { return reinterpret_cast<char*>(this + 1); }
+
+    const char* getName () const
+    {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+
+    char* getMessage () { return getName () + mNameLen + 1; }
+
+    const char* getMessage () const { return getName () + mNameLen + 1; }
+
+    logSeverity::level getSeverity () const
+    {
+        return static_cast<logSeverity::level>(mSeverity);
+    }
+
+    static size_t align (size_t length) { return (length + 7) & ~(size_t)7; }
+
+    // bytes needed to hold a record, message terminator included
+    static size_t sizeFor (size_t nameLen, size_t messageLen)
+    {
+        return align (sizeof (logRecord) + nameLen + 1 + messageLen + 1);
+    }
+
+    // fill in everything but the message, returns where it goes
+    char* init (uint32_t loggerId,
+                const char* name,
+                size_t nameLen,
+                logSeverity::level severity,
+                uint64_t time)
+    {
+        mNameLen = nameLen;
+        mSeverity = severity;
+        mFlags = 0;
+        mMessageLen = 0;
+        mLoggerId = loggerId;
+        mTime = time;
+        mFormat = NULL;
+
+        memcpy (getName (), name, nameLen);
+        getName ()[nameLen] = '\0';
+        return getMessage ();
+    }
+
+    // the message is in place, returns the length to publish
+    size_t finish (size_t messageLen)
+    {
+        mMessageLen = messageLen;
+        getMessage ()[messageLen] = '\0';
+        return sizeFor (mNameLen, messageLen);
+    }
+
+    // mark length bytes at memory as a record to skip
+    static void pad (char* memory, size_t length)
+    {
+        logRecord* filler = reinterpret_cast<logRecord*>(memory);
+        filler->mFlags = RECORD_PAD;
+        __atomic_store_n (&filler->mLength, length, __ATOMIC_RELEASE);
+    }
+};
+
+};
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logRegistry.h"
+#include "logger.h"
+
+#include <cstring>
+
+namespace neueda
+{
+
+const uint32_t logRegistry::kNoId;
+
+logRegistry::logRegistry () :
+    mGeneration (0)
+{
+    memset (mChunks, 0, sizeof mChunks);
+    sbfMutex_init (&mMutex, 0);
+}
+
+logRegistry::~logRegistry ()
+{
+    std::map<std::string, logger*>::iterator it;
+    for (it = mByName.begin (); it != mByName.end (); ++it)
+        delete it->second;
+
+    for (size_t i = 0; i < kChunks; i++)
+        delete [] mChunks[i];
+
+    sbfMutex_destroy (&mMutex);
+}
+
+logger*
+logRegistry::get (const std::string& name,
+                  logService* service,
+                  logSeverity::level level)
+{
+    sbfMutex_lock (&mMutex);
+
+    std::map<std::string, logger*>::iterator it = mByName.find (name);
+    if (it != mByName.end ())
+    {
+        logger* l = it->second;
+        sbfMutex_unlock (&mMutex);
+        return l;
+    }
+
+    size_t count = mByName.size ();
+    uint32_t id = count < kMaxLoggers ? count : kNoId;
+
+    logger* l = new logger (name, service, level, id);
+    l->mGeneration = mGeneration - 1;
+    refresh (l, service->getHandlerLevel ());
+    mByName.insert (std::make_pair (name, l));
+
+    if (id != kNoId)
+    {
+        logger** chunk = mChunks[id / kChunkSize];
+        if (chunk == NULL)
+        {
+            chunk = new logger*[kChunkSize];
+            memset (chunk, 0, kChunkSize * sizeof (logger*));
+            __atomic_store_n (&mChunks[id / kChunkSize], chunk, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n (&chunk[id % kChunkSize], l, __ATOMIC_RELEASE);
+    }
+
+    sbfMutex_unlock (&mMutex);
+    return l;
+}
+
+size_t
+logRegistry::size ()
+{
+    sbfMutex_lock (&mMutex);
+    size_t count = mByName.size ();
+    sbfMutex_unlock (&mMutex);
+
+    return count;
+}
+
+void
+logRegistry::setLevels (const std::map<std::string, logSeverity::level>& rules,
+                        logSeverity::level handlerLevel)
+{
+    sbfMutex_lock (&mMutex);
+
+    mConfigured = rules;
+    rulesChanged (handlerLevel);
+
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+logRegistry::setLevel (const std::string& pattern,
+                       logSeverity::level level,
+                       logSeverity::level handlerLevel)
+{
+    sbfMutex_lock (&mMutex);
+
+    mSet[pattern] = level;
+    rulesChanged (handlerLevel);
+
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+logRegistry::rulesChanged (logSeverity::level handlerLevel)
+{
+    mRules = mConfigured;
+
+    std::map<std::string, logSeverity::level>::const_iterator it;
+    for (it = mSet.begin (); it != mSet.end (); ++it)
+        mRules[it->first] = it->second;
+    mGeneration++;
+
+    std::map<std::string, logger*>::iterator lit;
+    for (lit = mByName.begin (); lit != mByName.end (); ++lit)
+        refresh (lit->second, handlerLevel);
+}
+
+void
+logRegistry::refreshThresholds (logSeverity::level handlerLevel)
+{
+    sbfMutex_lock (&mMutex);
+
+    std::map<std::string, logger*>::iterator it;
+    for (it = mByName.begin (); it != mByName.end (); ++it)
+        refresh (it->second, handlerLevel);
+
+    sbfMutex_unlock (&mMutex);
+}
+
+logSeverity::level
+logRegistry::resolve (const std::string& name,
+                      logSeverity::level fallback) const
+{
+    std::map<std::string, logSeverity::level>::const_iterator it;
+    if ((it = mRules.find (name)) != mRules.end ())
+        return it->second;
+
+    // nearest ancestor first, "a.*" and "a" both cover everything below a
+    std::string parent (name);
+    size_t dot;
+    while ((dot = parent.rfind ('.')) != std::string::npos)
+    {
+        parent.erase (dot);
+        if ((it = mRules.find (parent + ".*")) != mRules.end ())
+            return it->second;
+        if ((it = mRules.find (parent)) != mRules.end ())
+            return it->second;
+    }
+
+    if ((it = mRules.find ("*")) != mRules.end ())
+        return it->second;
+    return fallback;
+}
+
+void
+logRegistry::refresh (logger* l, logSeverity::level handlerLevel)
+{
+    if (l->mGeneration != mGeneration)
+    {
+        l->mLevel = resolve (l->mName, l->mDefaultLevel);
+        l->mGeneration = mGeneration;
+    }
+    l->refreshThreshold (handlerLevel);
+}
+
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logSeverity.h"
+#include "sbfCommon.h"
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+namespace neueda
+{
+
+class logger;
+class logService;
+
+/*
+ * Every logger the service has handed out, each with a small integer id
+ * that async records carry in place of the name. Lookups by name take a
+ * lock; lookups by id are lock free so the dispatch thread can resolve
+ * names without contending with loggers being created. Ids index a table
+ * of fixed size chunks which never move once published.
+ *
+ * Also holds the level rules. Names are dotted, a logger without a rule of
+ * its own takes the level of its nearest ancestor with one. Each logger
+ * caches the level it resolved to along with the rule generation it was
+ * resolved at, so only rule changes send it back to the rules.
+ */
+class logRegistry
+{
+public:
+    static const uint32_t kNoId = 0xffffffff;
+
+    logRegistry ();
+
+    // deletes the loggers
+    ~logRegistry ();
+
+    // the logger with this name, created at the given level if new
+    logger* get (const std::string& name,
+                 logService* service,
+                 logSeverity::level level);
+
+    // NULL for an unknown id
+    logger* find (uint32_t id) const
+    {
+        if (id >= kMaxLoggers)
+            return NULL;
+
+        logger** chunk = __atomic_load_n (&mChunks[id / kChunkSize],
+                                          __ATOMIC_ACQUIRE);
+        if (chunk == NULL)
+            return NULL;
+        return __atomic_load_n (&chunk[id % kChunkSize], __ATOMIC_ACQUIRE);
+    }
+
+    size_t size ();
+
+    // replace the configured level rules, keyed by a logger name, a name
+    // followed by ".*" for every logger below it, or "*" for all of them
+    void setLevels (const std::map<std::string, logSeverity::level>& rules,
+                    logSeverity::level handlerLevel);
+
+    // add or replace one rule set at runtime. These outlive setLevels and
+    // win over a configured rule with the same key
+    void setLevel (const std::string& pattern,
+                   logSeverity::level level,
+                   logSeverity::level handlerLevel);
+
+    // see logger::refreshThreshold
+    void refreshThresholds (logSeverity::level handlerLevel);
+
+private:
+    logRegistry (const logRegistry& that);
+    void operator= (const logRegistry& that);
+
+    static const size_t kChunkSize = 256;
+    static const size_t kChunks = 4096;
+
+    // loggers beyond this still work, their records carry the name
+    static const size_t kMaxLoggers = kChunkSize * kChunks;
+
+    // the most specific rule matching name, fallback if none does
+    logSeverity::level resolve (const std::string& name,
+                                logSeverity::level fallback) const;
+
+    // re-resolve l if the rules changed since it last did
+    void refresh (logger* l, logSeverity::level handlerLevel);
+
+    // rebuild mRules from both sets and bring every logger up to date,
+    // called with mMutex held
+    void rulesChanged (logSeverity::level handlerLevel);
+
+    sbfMutex                        mMutex;
+    std::map<std::string, logger*>  mByName;
+    std::map<std::string, logSeverity::level> mConfigured;
+    std::map<std::string, logSeverity::level> mSet;
+    std::map<std::string, logSeverity::level> mRules;   // both of the above
+    uint32_t                        mGeneration;
+    logger**                        mChunks[kChunks];
+};
+
+};
@@ -0,0 +1,486 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logSegments.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// how much of a closed file is read at a time while it is gzipped
+static const size_t compressChunkSize = 64 * 1024;
+
+static const char compressedSuffix[] = ".gz";
+
+namespace neueda
+{
+
+static bool
+endsWith (const std::string& s, const char* suffix)
+{
+    size_t n = strlen (suffix);
+    return s.size () >= n && s.compare (s.size () - n, n, suffix) == 0;
+}
+
+static bool
+isDigits (const std::string& s, size_t from, size_t to)
+{
+    if (from >= to || to > s.size ())
+        return false;
+    for (size_t i = from; i < to; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+    }
+    return true;
+}
+
+logSegments::logSegments (const std::string& path,
+                          naming n,
+                          int flags,
+                          int count,
+                          bool compress) :
+    mPath (path),
+    mNaming (n),
+    mFlags (flags),
+    mCount (count),
+    mCompress (compress),
+    mPeriod (0),
+    mSequence (0),
+    mHandedOut (false),
+    mOpenedStart (0),
+    mNextFd (-1),
+    mNextStart (0),
+    mOpening (false),
+    mOpenFailed (false),
+    mRunning (false),
+    mStopping (false)
+{
+    size_t slash = path.rfind ('/');
+    if (slash == std::string::npos)
+    {
+        mDir = ".";
+        mBase = path;
+    }
+    else
+    {
+        mDir = slash == 0 ? "/" : path.substr (0, slash);
+        mBase = path.substr (slash + 1);
+    }
+
+    sbfMutex_init (&mMutex, 0);
+    sbfCondVar_init (&mCond);
+    sbfCondVar_init (&mOpened);
+}
+
+logSegments::~logSegments ()
+{
+    stop ();
+
+    sbfCondVar_destroy (&mOpened);
+    sbfCondVar_destroy (&mCond);
+    sbfMutex_destroy (&mMutex);
+}
+
+bool
+logSegments::parseNaming (const std::string& value, naming& n)
+{
+    if (value == "rename")
+        n = NAMING_RENAME;
+    else if (value == "sequence")
+        n = NAMING_SEQUENCE;
+    else if (value == "timestamp")
+        n = NAMING_TIMESTAMP;
+    else
+        return false;
+    return true;
+}
+
+bool
+logSegments::start (std::string& errorMessage)
+{
+    DIR* dir = opendir (mDir.c_str ());
+    if (dir == NULL)
+    {
+        errorMessage.assign (strerror (errno));
+        return false;
+    }
+
+    // files left by earlier runs, ordered oldest first
+    std::map<std::string, std::string> found;
+    std::string prefix = mBase + ".";
+
+    struct dirent* entry;
+    while ((entry = readdir (dir)) != NULL)
+    {
+        std::string name (entry->d_name);
+        if (name.compare (0, prefix.size (), prefix) != 0)
+            continue;
+
+        std::string suffix = name.substr (prefix.size ());
+        if (endsWith (suffix, compressedSuffix))
+            suffix.erase (suffix.size () - strlen (compressedSuffix));
+
+        std::string key;
+        if (mNaming == NAMING_SEQUENCE)
+        {
+            if (!isDigits (suffix, 0, suffix.size ()) || suffix.size () > 19)
+                continue;
+
+            uint64_t n = strtoull (suffix.c_str (), NULL, 10);
+            if (n > mSequence)
+                mSequence = n;
+
+            char padded[32];
+            snprintf (padded, sizeof padded, "%020llu", (unsigned long long)n);
+            key = padded;
+        }
+        else
+        {
+            // YYYYmmdd-HHMMSS, maybe .N after it
+            if (!isDigits (suffix, 0, 8)
+                || suffix.size () < 15
+                || suffix[8] != '-'
+                || !isDigits (suffix, 9, 15))
+                continue;
+
+            // padded so .10 comes after .2
+            uint64_t n = 0;
+            if (suffix.size () > 16
+                && suffix[15] == '.'
+                && isDigits (suffix, 16, suffix.size ()))
+                n = strtoull (suffix.c_str () + 16, NULL, 10);
+
+            char padded[32];
+            snprintf (padded, sizeof padded, "%020llu", (unsigned long long)n);
+            key = suffix.substr (0, 15) + padded;
+        }
+
+        found[key + name] = name;
+    }
+    closedir (dir);
+
+    std::string base = mDir + "/";
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = found.begin (); it != found.end (); ++it)
+    {
+        mClosed.push_back (base + it->second);
+        if (mCompress && !endsWith (it->second, compressedSuffix))
+            mToCompress.push_back (base + it->second);
+    }
+
+    mStopping = false;
+    mRunning = sbfThread_create (&mThread, logSegments::run, this) == 0;
+    if (!mRunning)
+    {
+        errorMessage.assign ("failed to start segment thread");
+        return false;
+    }
+    return true;
+}
+
+void
+logSegments::stop ()
+{
+    if (!mRunning)
+        return;
+
+    sbfMutex_lock (&mMutex);
+    mStopping = true;
+    sbfCondVar_signal (&mCond);
+    sbfMutex_unlock (&mMutex);
+
+    sbfThread_join (mThread);
+    mRunning = false;
+
+    // opened ahead and never written
+    if (mNextFd >= 0)
+    {
+        close (mNextFd);
+        unlink (mNextName.c_str ());
+        mNextFd = -1;
+    }
+}
+
+std::string
+logSegments::nextName (time_t start)
+{
+    std::ostringstream name;
+    name << mPath << ".";
+
+    if (mNaming == NAMING_SEQUENCE)
+    {
+        name << ++mSequence << mSuffix;
+        return name.str ();
+    }
+
+    char stamp[32];
+    time_t t = start != 0 ? start : time (NULL);
+    struct tm tm;
+    gmtime_r (&t, &tm);
+    strftime (stamp, sizeof stamp, "%Y%m%d-%H%M%S", &tm);
+    name << stamp;
+
+    // more than one file within the second or the period
+    if (mLastTime == stamp)
+        name << "." << ++mSequence;
+    else
+        mSequence = 0;
+    mLastTime = stamp;
+
+    name << mSuffix;
+    return name.str ();
+}
+
+int
+logSegments::create (std::string& name,
+                     time_t start,
+                     std::string& errorMessage)
+{
+    for (;;)
+    {
+        int fd = ::open (name.c_str (), mFlags | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0)
+            return fd;
+
+        if (errno != EEXIST)
+        {
+            errorMessage.assign (strerror (errno));
+            return -1;
+        }
+
+        // never write over a file already there, take the next name
+        sbfMutex_lock (&mMutex);
+        name = nextName (start);
+        sbfMutex_unlock (&mMutex);
+    }
+}
+
+int
+logSegments::next (std::string& name,
+                   std::string& errorMessage,
+                   time_t start)
+{
+    sbfMutex_lock (&mMutex);
+
+    // nearly there, and names stay in order
+    while (mOpening)
+        sbfCondVar_wait (&mOpened, &mMutex);
+
+    int fd = -1;
+    int stale = -1;
+    std::string staleName;
+    if (mNextFd >= 0 && mNextStart == start)
+    {
+        fd = mNextFd;
+        name = mNextName;
+    }
+    else if (mNextFd >= 0)
+    {
+        // opened for a period that has been skipped, or rolled early
+        stale = mNextFd;
+        staleName = mNextName;
+    }
+    mNextFd = -1;
+
+    if (fd < 0)
+        name = nextName (start);
+    mHandedOut = true;
+    mOpenFailed = false;
+    mOpenedStart = start;
+
+    // have another ready by the next roll
+    sbfCondVar_signal (&mCond);
+    sbfMutex_unlock (&mMutex);
+
+    if (stale >= 0)
+    {
+        close (stale);
+        unlink (staleName.c_str ());
+    }
+
+    // the thread has not got to it, open it here
+    if (fd < 0)
+        fd = create (name, start, errorMessage);
+    return fd;
+}
+
+void
+logSegments::retire (const std::string& name)
+{
+    sbfMutex_lock (&mMutex);
+
+    mClosed.push_back (name);
+    if (mCompress)
+        mToCompress.push_back (name);
+    sbfCondVar_signal (&mCond);
+
+    sbfMutex_unlock (&mMutex);
+}
+
+bool
+logSegments::isOverCount () const
+{
+    // the file being written counts as one of them
+    return mCount > 0 && mClosed.size () >= (size_t)mCount;
+}
+
+bool
+logSegments::compress (const std::string& name)
+{
+    int in = ::open (name.c_str (), O_RDONLY);
+    if (in < 0)
+        return false;
+
+    std::string to = name + compressedSuffix;
+    gzFile out = gzopen (to.c_str (), "wb");
+    if (out == NULL)
+    {
+        close (in);
+        return false;
+    }
+
+    bool ok = true;
+    char buffer[compressChunkSize];
+    for (;;)
+    {
+        ssize_t n = read (in, buffer, sizeof buffer);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite (out, buffer, (unsigned)n) != (int)n)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    close (in);
+    if (gzclose (out) != Z_OK)
+        ok = false;
+
+    // keep the original rather than lose lines
+    if (!ok)
+    {
+        unlink (to.c_str ());
+        return false;
+    }
+
+    unlink (name.c_str ());
+    return true;
+}
+
+bool
+logSegments::isOpeningAhead () const
+{
+    // a timestamp without a period is the time the file is handed out,
+    // not known ahead
+    if (mNaming == NAMING_TIMESTAMP && mPeriod == 0)
+        return false;
+
+    return mHandedOut && mNextFd < 0 && !mOpenFailed;
+}
+
+void*
+logSegments::run (void* closure)
+{
+    logSegments* self = static_cast<logSegments*>(closure);
+
+    sbfMutex_lock (&self->mMutex);
+    for (;;)
+    {
+        bool opening = self->isOpeningAhead ();
+        while (!self->mStopping
+               && !opening
+               && self->mToCompress.empty ()
+               && !self->isOverCount ())
+        {
+            sbfCondVar_wait (&self->mCond, &self->mMutex);
+            opening = self->isOpeningAhead ();
+        }
+
+        // the next file first, a roll may be waiting on it
+        if (opening && !self->mStopping)
+        {
+            time_t start = 0;
+            if (self->mPeriod != 0)
+                start = self->mOpenedStart + self->mPeriod;
+
+            std::string name = self->nextName (start);
+            self->mOpening = true;
+            sbfMutex_unlock (&self->mMutex);
+
+            std::string errorMessage;
+            int fd = self->create (name, start, errorMessage);
+
+            sbfMutex_lock (&self->mMutex);
+            self->mOpening = false;
+            sbfCondVar_broadcast (&self->mOpened);
+            if (fd < 0)
+            {
+                // leave it to the roll to try again and report it
+                self->mOpenFailed = true;
+                continue;
+            }
+            self->mNextFd = fd;
+            self->mNextName = name;
+            self->mNextStart = start;
+            continue;
+        }
+
+        // compressed before they are counted, so never one being deleted
+        if (!self->mToCompress.empty ())
+        {
+            std::string name = self->mToCompress.front ();
+            self->mToCompress.pop_front ();
+            sbfMutex_unlock (&self->mMutex);
+
+            bool compressed = compress (name);
+
+            sbfMutex_lock (&self->mMutex);
+            if (compressed)
+            {
+                std::replace (self->mClosed.begin (),
+                              self->mClosed.end (),
+                              name,
+                              name + compressedSuffix);
+            }
+            continue;
+        }
+
+        if (self->isOverCount ())
+        {
+            std::string name = self->mClosed.front ();
+            self->mClosed.pop_front ();
+            sbfMutex_unlock (&self->mMutex);
+
+            unlink (name.c_str ());
+
+            sbfMutex_lock (&self->mMutex);
+            continue;
+        }
+
+        if (self->mStopping)
+            break;
+    }
+    sbfMutex_unlock (&self->mMutex);
+
+    return NULL;
+}
+
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "sbfCommon.h"
+
+#include <deque>
+#include <string>
+#include <ctime>
+#include <stdint.h>
+
+namespace neueda
+{
+
+/*
+ * The files a fileLogHandler rolls through when each is given a name of
+ * its own rather than the older ones being renamed on every roll. A
+ * thread of its own opens the next file ahead of time, so rolling only
+ * swaps descriptors, and deals with the closed files: gzips them when
+ * asked to and deletes the oldest beyond the number to keep. Timestamp
+ * names without a period are the time of the roll, so those files are
+ * opened by the roll itself.
+ */
+class logSegments
+{
+public:
+    enum naming
+    {
+        NAMING_RENAME = 0,  // path, path.1, path.2 .. renamed on roll
+        NAMING_SEQUENCE,    // path.1, path.2 .. the highest is written
+        NAMING_TIMESTAMP    // path.YYYYmmdd-HHMMSS in utc, when opened
+                            // or the start of its period, .N after it
+                            // for more than one in the same second
+    };
+
+    // flags are those open is given for each file, count is how many
+    // files to keep including the one being written, 0 for all of them
+    logSegments (const std::string& path,
+                 naming n,
+                 int flags,
+                 int count,
+                 bool compress);
+
+    ~logSegments ();
+
+    // files each cover a period of this many seconds, so the next one is
+    // known and opened ahead of the boundary. Call before start
+    void setPeriod (uint64_t seconds) { mPeriod = seconds; }
+
+    // put after each name, for files written already compressed. Call
+    // before start
+    void setSuffix (const std::string& suffix) { mSuffix = suffix; }
+
+    // picks up numbering and the files to keep from those already there
+    bool start (std::string& errorMessage);
+
+    // finishes with the closed files and removes a next file never used
+    void stop ();
+
+    // the next file to write, for the period from start when there is
+    // one. -1 with errorMessage set if it cannot be created
+    int next (std::string& name, std::string& errorMessage, time_t start);
+
+    // a file written and closed
+    void retire (const std::string& name);
+
+    static bool parseNaming (const std::string& value, naming& n);
+
+    // gzips name to name.gz and removes it, false if that failed
+    static bool compress (const std::string& name);
+
+private:
+    logSegments (const logSegments& that);
+    void operator= (const logSegments& that);
+
+    std::string nextName (time_t start);
+
+    int create (std::string& name, time_t start, std::string& errorMessage);
+
+    bool isOverCount () const;
+
+    // the thread should open the next file now
+    bool isOpeningAhead () const;
+
+    static void* run (void* closure);
+
+    std::string                 mPath;
+    std::string                 mDir;
+    std::string                 mBase;
+    std::string                 mSuffix;
+    naming                      mNaming;
+    int                         mFlags;
+    int                         mCount;
+    bool                        mCompress;
+    uint64_t                    mPeriod;
+    uint64_t                    mSequence;
+    std::string                 mLastTime;
+    bool                        mHandedOut;     // next has been called
+    time_t                      mOpenedStart;   // period of the last handed out
+    int                         mNextFd;
+    std::string                 mNextName;
+    time_t                      mNextStart;
+    bool                        mOpening;       // the thread is opening one
+    bool                        mOpenFailed;    // not again until next
+    std::deque<std::string>     mClosed;        // oldest first
+    std::deque<std::string>     mToCompress;
+    bool                        mRunning;
+    bool                        mStopping;
+    sbfThread                   mThread;
+    sbfMutex                    mMutex;
+    sbfCondVar                  mCond;
+    sbfCondVar                  mOpened;
+};
+
+};
@@ -0,0 +1,566 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logStaging.h"
+#include "logArgs.h"
+#include "logRegistry.h"
+#include "logger.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <pthread.h>
+
+// drained rings kept for reuse by new threads, beyond this they are freed
+static const size_t kMaxPooledRings = 16;
+
+namespace neueda
+{
+
+/*
+ * Byte ring written by exactly one thread and read by the consumer.
+ * Positions only ever grow, the ring offset is position & mask. A record
+ * that would straddle the end of the ring is preceded by a pad record
+ * filling the remainder so every record is contiguous.
+ */
+class logStagingRing
+{
+public:
+    logStagingRing (size_t size, uint64_t generation) :
+        mNext (NULL),
+        mBuffer (NULL),
+        mSize (size),
+        mMask (size - 1),
+        mGeneration (generation),
+        mHead (0),
+        mReserve (0),
+        mCachedTail (0),
+        mPublished (0),
+        mRead (0),
+        mTail (0),
+        mShedWanted (0),
+        mRefs (2),
+        mClosed (false)
+    {
+        void* mem = NULL;
+        if (posix_memalign (&mem, 64, mSize) != 0)
+            abort ();
+        mBuffer = static_cast<char*>(mem);
+    }
+
+    ~logStagingRing ()
+    {
+        free (mBuffer);
+    }
+
+    // ready to be handed to a new thread, only once both the old owner
+    // and the consumer are done with it
+    void reset (uint64_t generation)
+    {
+        mNext = NULL;
+        mGeneration = generation;
+        mHead = 0;
+        mReserve = 0;
+        mCachedTail = 0;
+        mPublished = 0;
+        mRead = 0;
+        mTail = 0;
+        mShedWanted = 0;
+        mRefs = 2;
+        mClosed = false;
+    }
+
+    // producer side, room for length bytes at mReserve, NULL when the
+    // ring is full and the overflow policy drops the record
+    logRecord* reserve (size_t length,
+                        logSeverity::level severity,
+                        logWaiter& waiter,
+                        logOverflow& overflow)
+    {
+        uint64_t pos = mHead;
+        size_t offset = pos & mMask;
+        size_t pad = (offset + length > mSize) ? mSize - offset : 0;
+
+        unsigned int spins = 0;
+        while (pos + pad + length - mCachedTail > mSize)
+        {
+            mCachedTail = __atomic_load_n (&mTail, __ATOMIC_ACQUIRE);
+            if (pos + pad + length - mCachedTail > mSize)
+            {
+                if (overflow.onFull (severity,
+                                     mShedWanted,
+                                     pos + pad + length - mCachedTail - mSize))
+                    return NULL;
+                waiter.backoff (spins);
+            }
+        }
+
+        if (pad > 0)
+        {
+            logRecord::pad (mBuffer + offset, pad);
+            pos += pad;
+        }
+
+        mReserve = pos;
+        return reinterpret_cast<logRecord*>(mBuffer + (pos & mMask));
+    }
+
+    // producer side, make the reserved record visible
+    void commit (logRecord* record, size_t length)
+    {
+        record->mLength = length;
+        mHead = mReserve + length;
+        __atomic_store_n (&mPublished, mHead, __ATOMIC_RELEASE);
+    }
+
+    // consumer side, next unread record or NULL
+    const logRecord* peek ()
+    {
+        uint64_t head = __atomic_load_n (&mPublished, __ATOMIC_ACQUIRE);
+        while (mRead != head)
+        {
+            const logRecord* record =
+                reinterpret_cast<const logRecord*>(mBuffer + (mRead & mMask));
+            if (!(record->mFlags & logRecord::RECORD_PAD))
+                return record;
+
+            mRead += record->mLength;
+        }
+        return NULL;
+    }
+
+    bool isEmpty () const
+    {
+        return __atomic_load_n (&mPublished, __ATOMIC_ACQUIRE) == mRead;
+    }
+
+    // consumer side, move past the record peek returned. It stays in
+    // place until consume hands the space back to the producer
+    void advance ()
+    {
+        const logRecord* record =
+            reinterpret_cast<const logRecord*>(mBuffer + (mRead & mMask));
+        mRead += record->mLength;
+    }
+
+    // consumer side, discard the oldest records until the producer has
+    // the room it asked for, returns how many
+    uint64_t shed ()
+    {
+        uint64_t wanted = logOverflow::takeWanted (mShedWanted);
+        if (wanted == 0)
+            return 0;
+
+        uint64_t from = mRead;
+        uint64_t count = 0;
+        while ((count == 0 || mRead - from < wanted) && peek () != NULL)
+        {
+            advance ();
+            count++;
+        }
+        consume ();
+        return count;
+    }
+
+    void consume ()
+    {
+        if (mTail != mRead)
+            __atomic_store_n (&mTail, mRead, __ATOMIC_RELEASE);
+    }
+
+    // the owning thread is done with the ring
+    void close ()
+    {
+        __atomic_store_n (&mClosed, true, __ATOMIC_RELEASE);
+    }
+
+    bool isClosed () const
+    {
+        return __atomic_load_n (&mClosed, __ATOMIC_ACQUIRE);
+    }
+
+    uint64_t getGeneration () const { return mGeneration; }
+
+    // whether the owning thread still holds its reference
+    bool isOwned () const
+    {
+        return __atomic_load_n (&mRefs, __ATOMIC_ACQUIRE) > 1;
+    }
+
+    static void unref (logStagingRing* ring)
+    {
+        if (__atomic_sub_fetch (&ring->mRefs, 1, __ATOMIC_ACQ_REL) == 0)
+            delete ring;
+    }
+
+    logStagingRing*     mNext;
+
+private:
+    char*               mBuffer;
+    size_t              mSize;
+    size_t              mMask;
+    uint64_t            mGeneration;
+
+    // producer only
+    char                mPad0[64];
+    uint64_t            mHead;
+    uint64_t            mReserve;
+    uint64_t            mCachedTail;
+
+    char                mPad1[64];
+    volatile uint64_t   mPublished;
+
+    // consumer only, apart from the producer reading mTail
+    char                mPad2[64];
+    uint64_t            mRead;
+    volatile uint64_t   mTail;
+    volatile uint64_t   mShedWanted;    // bytes short, for drop-oldest
+
+    char                mPad3[64];
+    volatile int        mRefs;
+    volatile bool       mClosed;
+};
+
+static uint64_t stagingGeneration = 0;
+
+static __thread logStagingRing* tlsRing = NULL;
+
+static void
+releaseRing (logStagingRing* ring)
+{
+    ring->close ();
+    logStagingRing::unref (ring);
+}
+
+static pthread_key_t  ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+freeRing (void* closure)
+{
+    releaseRing (static_cast<logStagingRing*>(closure));
+}
+
+static void
+createRingKey ()
+{
+    pthread_key_create (&ringKey, freeRing);
+}
+
+logStaging::logStaging (size_t ringSize,
+                        logWaiter::strategy strategy,
+                        logOverflow::policy overflow,
+                        logSeverity::level dropBelow) :
+    mRingSize (1),
+    mGeneration (__atomic_add_fetch (&stagingGeneration,
+                                     1,
+                                     __ATOMIC_RELAXED)),
+    mRings (NULL),
+    mCurrent (NULL),
+    mPool (NULL),
+    mPooled (0),
+    mAllocated (0),
+    mReused (0),
+    mInUse (0),
+    mWaiter (strategy),
+    mOverflow (overflow, dropBelow)
+{
+    if (ringSize < minRingSize ())
+        ringSize = minRingSize ();
+    while (mRingSize < ringSize)
+        mRingSize <<= 1;
+
+    sbfMutex_init (&mRingsMutex, 0);
+}
+
+logStaging::~logStaging ()
+{
+    logStagingRing* ring = mRings;
+    while (ring != NULL)
+    {
+        logStagingRing* next = ring->mNext;
+        logStagingRing::unref (ring);
+        ring = next;
+    }
+
+    ring = mPool;
+    while (ring != NULL)
+    {
+        logStagingRing* next = ring->mNext;
+        delete ring;
+        ring = next;
+    }
+
+    sbfMutex_destroy (&mRingsMutex);
+}
+
+size_t
+logStaging::minRingSize ()
+{
+    return 4 * logRecord::sizeFor (logRecord::kMaxNameLength,
+                                   defaultLogMessageChunkSize);
+}
+
+logStagingRing*
+logStaging::getRing ()
+{
+    logStagingRing* ring = tlsRing;
+    if (ring != NULL && ring->getGeneration () == mGeneration)
+        return ring;
+
+    // first record from this thread, or the service was restarted with a
+    // new backend since the thread last logged
+    if (ring != NULL)
+        releaseRing (ring);
+
+    sbfMutex_lock (&mRingsMutex);
+
+    // a ring left behind by an exited thread saves a fresh allocation,
+    // which the consumer would otherwise free on another thread
+    ring = mPool;
+    if (ring != NULL)
+    {
+        mPool = ring->mNext;
+        mPooled--;
+        mReused++;
+        ring->reset (mGeneration);
+    }
+    else
+    {
+        ring = new logStagingRing (mRingSize, mGeneration);
+        mAllocated++;
+    }
+    mInUse++;
+
+    ring->mNext = mRings;
+    __atomic_store_n (&mRings, ring, __ATOMIC_RELEASE);
+    sbfMutex_unlock (&mRingsMutex);
+
+    pthread_once (&ringKeyOnce, createRingKey);
+    pthread_setspecific (ringKey, ring);
+    tlsRing = ring;
+
+    return ring;
+}
+
+void
+logStaging::write (uint32_t loggerId,
+                   const string& name,
+                   logSeverity::level severity,
+                   uint64_t time,
+                   const char* message,
+                   size_t messageLen)
+{
+    size_t nameLen = loggerId == logRegistry::kNoId ?
+        std::min (name.size (), logRecord::kMaxNameLength) : 0;
+
+    logStagingRing* ring = getRing ();
+    logRecord* record = ring->reserve (logRecord::sizeFor (nameLen, messageLen),
+                                       severity,
+                                       mWaiter,
+                                       mOverflow);
+    if (record == NULL)
+        return;
+
+    char* body = record->init (loggerId, name.c_str (), nameLen, severity, time);
+    memcpy (body, message, messageLen);
+
+    ring->commit (record, record->finish (messageLen));
+    mWaiter.notify ();
+}
+
+bool
+logStaging::writeDeferred (uint32_t loggerId,
+                           const string& name,
+                           logSeverity::level severity,
+                           uint64_t time,
+                           const char* fmt,
+                           va_list ap)
+{
+    size_t nameLen = loggerId == logRegistry::kNoId ?
+        std::min (name.size (), logRecord::kMaxNameLength) : 0;
+
+    // encode straight into the ring, nothing is committed if the
+    // arguments turn out not to be replayable
+    logStagingRing* ring = getRing ();
+    logRecord* record =
+        ring->reserve (logRecord::sizeFor (nameLen, defaultLogMessageChunkSize),
+                       severity,
+                       mWaiter,
+                       mOverflow);
+
+    // dropped, there is nothing left for the caller to do
+    if (record == NULL)
+        return true;
+
+    char* body = record->init (loggerId, name.c_str (), nameLen, severity, time);
+
+    size_t length = 0;
+    if (!logArgs::encode (fmt, ap, body, defaultLogMessageChunkSize, length))
+        return false;
+
+    record->mFormat = fmt;
+
+    ring->commit (record, record->finish (length));
+    mWaiter.notify ();
+    return true;
+}
+
+const logRecord*
+logStaging::next ()
+{
+    const logRecord* oldest = NULL;
+    mCurrent = NULL;
+
+    logStagingRing* ring = __atomic_load_n (&mRings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->mNext)
+    {
+        const logRecord* record = ring->peek ();
+        if (record != NULL && (oldest == NULL || record->mTime < oldest->mTime))
+        {
+            oldest = record;
+            mCurrent = ring;
+        }
+    }
+    return oldest;
+}
+
+bool
+logStaging::isReady () const
+{
+    const logStagingRing* ring = __atomic_load_n (&mRings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->mNext)
+    {
+        if (!ring->isEmpty ())
+            return true;
+    }
+    return false;
+}
+
+void
+logStaging::reclaim ()
+{
+    sbfMutex_lock (&mRingsMutex);
+
+    logStagingRing** link = &mRings;
+    while (*link != NULL)
+    {
+        logStagingRing* ring = *link;
+
+        // closed is checked first, the owner commits before it closes.
+        // The owner drops its reference just after closing, the ring is
+        // left for a later pass until it has
+        if (ring->isClosed () && ring->peek () == NULL && !ring->isOwned ())
+        {
+            *link = ring->mNext;
+            mInUse--;
+
+            if (mPooled < kMaxPooledRings)
+            {
+                ring->mNext = mPool;
+                mPool = ring;
+                mPooled++;
+            }
+            else
+                logStagingRing::unref (ring);
+        }
+        else
+            link = &ring->mNext;
+    }
+
+    sbfMutex_unlock (&mRingsMutex);
+}
+
+const logRecord*
+logStaging::take ()
+{
+    unsigned int spins = 0;
+    bool reclaimed = false;
+    for (;;)
+    {
+        if (mOverflow.takeShed ())
+            shed ();
+
+        bool stopped = mWaiter.isStopped ();
+
+        const logRecord* record = next ();
+        if (record != NULL)
+            return record;
+
+        if (stopped)
+            return NULL;
+
+        // nothing to do, a good time to tidy up after exited threads
+        if (!reclaimed)
+        {
+            reclaim ();
+            reclaimed = true;
+        }
+        mWaiter.idle (spins, *this);
+    }
+}
+
+void
+logStaging::shed ()
+{
+    uint64_t count = 0;
+    logStagingRing* ring = __atomic_load_n (&mRings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->mNext)
+        count += ring->shed ();
+
+    mOverflow.dropped (count);
+}
+
+void
+logStaging::release ()
+{
+    mCurrent->advance ();
+    mCurrent->consume ();
+}
+
+size_t
+logStaging::takeBatch (const logRecord** records, size_t max)
+{
+    const logRecord* record = take ();
+    if (record == NULL)
+        return 0;
+
+    size_t count = 0;
+    do
+    {
+        records[count++] = record;
+        mCurrent->advance ();
+    } while (count < max && (record = next ()) != NULL);
+
+    return count;
+}
+
+void
+logStaging::releaseBatch ()
+{
+    logStagingRing* ring = mRings;
+    for (; ring != NULL; ring = ring->mNext)
+        ring->consume ();
+}
+
+void
+logStaging::getPoolStats (logPoolStats& stats)
+{
+    sbfMutex_lock (&mRingsMutex);
+    stats.mAllocated = mAllocated;
+    stats.mReused = mReused;
+    stats.mInUse = mInUse;
+    stats.mPooled = mPooled;
+    stats.mBufferSize = mRingSize;
+    sbfMutex_unlock (&mRingsMutex);
+}
+
+void
+logStaging::stop ()
+{
+    mWaiter.stop ();
+}
+
+}
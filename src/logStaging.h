@@ -0,0 +1,136 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "logOverflow.h"
+#include "logRecord.h"
+#include "logWaiter.h"
+#include "sbfCommon.h"
+
+#include <cstdarg>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+namespace neueda
+{
+
+class logStagingRing;
+struct logPoolStats;
+
+/*
+ * Async backend where every producer thread owns a single-producer/
+ * single-consumer byte ring, allocated the first time the thread logs.
+ * Producers only touch their own ring, so they never contend with each
+ * other. The consumer drains all rings and always hands out the oldest
+ * staged record first, merging the per-thread streams into timestamp
+ * order.
+ *
+ * A ring outlives its thread until the consumer has drained it; rings are
+ * reference counted between the owning thread and this object. Drained
+ * rings of exited threads are pooled and handed to the next new thread.
+ * A thread's ring may outlive this object too, but write reserves through
+ * its waiter and overflow policy, so no producer may still be in write
+ * when it is deleted; logService waits them out in stopDispatching.
+ */
+class logStaging
+{
+public:
+    logStaging (size_t ringSize,
+                logWaiter::strategy strategy,
+                logOverflow::policy overflow = logOverflow::OVERFLOW_BLOCK,
+                logSeverity::level dropBelow = logSeverity::WARN);
+
+    ~logStaging ();
+
+    // producer side, waits while the calling thread's ring is full unless
+    // the overflow policy drops the record. The record must not exceed
+    // maxRecordSize ()
+    // the name is only copied when there is no logger id
+    void write (uint32_t loggerId,
+                const string& name,
+                logSeverity::level severity,
+                uint64_t time,
+                const char* message,
+                size_t messageLen);
+
+    // stage printf arguments for rendering on the consumer, false when
+    // they cannot be replayed and nothing was staged. A dropped record
+    // counts as staged
+    bool writeDeferred (uint32_t loggerId,
+                        const string& name,
+                        logSeverity::level severity,
+                        uint64_t time,
+                        const char* fmt,
+                        va_list ap);
+
+    // consumer side, returns NULL once stopped and drained
+    const logRecord* take ();
+
+    void release ();
+
+    // consumer side, waits for at least one record then takes up to max
+    // in timestamp order, returns 0 once stopped and drained. The records
+    // stay valid until releaseBatch
+    size_t takeBatch (const logRecord** records, size_t max);
+
+    void releaseBatch ();
+
+    void stop ();
+
+    size_t getRingSize () const { return mRingSize; }
+
+    logWaiter::strategy getWaitStrategy () const
+    {
+        return mWaiter.getStrategy ();
+    }
+
+    logOverflow& getOverflow () { return mOverflow; }
+
+    // whether any ring holds a record, for logWaiter
+    bool isReady () const;
+
+    size_t maxRecordSize () const { return mRingSize / 4; }
+
+    void getPoolStats (logPoolStats& stats);
+
+    // smallest ring that still holds a few deferred records
+    static size_t minRingSize ();
+
+private:
+    logStaging (const logStaging& that);
+    void operator= (const logStaging& that);
+
+    logStagingRing* getRing ();
+
+    // oldest visible record across all rings
+    const logRecord* next ();
+
+    // pool rings whose thread has gone and which are drained
+    void reclaim ();
+
+    // discard every staged record for drop-oldest
+    void shed ();
+
+    size_t              mRingSize;
+    uint64_t            mGeneration;
+
+    sbfMutex            mRingsMutex;
+    logStagingRing*     mRings;
+    logStagingRing*     mCurrent;
+
+    // under mRingsMutex
+    logStagingRing*     mPool;
+    size_t              mPooled;
+    size_t              mAllocated;
+    size_t              mReused;
+    size_t              mInUse;
+
+    logWaiter           mWaiter;
+    logOverflow         mOverflow;
+};
+
+};
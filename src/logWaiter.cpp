@@ -0,0 +1,93 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include "logWaiter.h"
+
+// spins before a producer facing a full ring yields
+static const unsigned int kFullSpinLimit = 1024;
+
+// longest a parked consumer sleeps before rechecking
+static const long kBlockTimeoutNs = 100 * 1000 * 1000;
+
+namespace neueda
+{
+
+logWaiter::logWaiter (strategy s) :
+    mStrategy (s),
+    mWaiting (0),
+    mStopped (false)
+{
+    sbfMutex_init (&mMutex, 0);
+    sbfCondVar_init (&mCond);
+}
+
+logWaiter::~logWaiter ()
+{
+    sbfCondVar_destroy (&mCond);
+    sbfMutex_destroy (&mMutex);
+}
+
+void
+logWaiter::stop ()
+{
+    __atomic_store_n (&mStopped, true, __ATOMIC_RELEASE);
+    wake ();
+}
+
+void
+logWaiter::backoff (unsigned int& spins)
+{
+    // spinning producers only hold off briefly so they cannot starve the
+    // consumer they are waiting on
+    if (mStrategy == WAIT_SPIN && spins++ < kFullSpinLimit)
+        cpuRelax ();
+    else
+        yield ();
+}
+
+void
+logWaiter::wake ()
+{
+    sbfMutex_lock (&mMutex);
+    sbfCondVar_signal (&mCond);
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+logWaiter::timedWait ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += kBlockTimeoutNs;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait (&mCond, &mMutex, &ts);
+}
+
+bool
+logWaiter::parseStrategy (const string& value, strategy& s)
+{
+    if (value == "block")
+    {
+        s = WAIT_BLOCK;
+        return true;
+    }
+    else if (value == "yield")
+    {
+        s = WAIT_YIELD;
+        return true;
+    }
+    else if (value == "spin")
+    {
+        s = WAIT_SPIN;
+        return true;
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#pragma once
+
+#include "sbfCommon.h"
+
+#include <string>
+#include <ctime>
+#include <sched.h>
+
+using namespace std;
+
+namespace neueda
+{
+
+/*
+ * Consumer side idling shared by the async backends. Producers call
+ * notify () after publishing, which only costs a fence and a load unless
+ * the consumer is parked under WAIT_BLOCK.
+ */
+class logWaiter
+{
+public:
+    enum strategy
+    {
+        WAIT_BLOCK = 0, // consumer spins briefly then sleeps on a condition
+        WAIT_YIELD,     // consumer yields the cpu while idle
+        WAIT_SPIN       // consumer busy waits, lowest latency
+    };
+
+    logWaiter (strategy s);
+
+    ~logWaiter ();
+
+    strategy getStrategy () const { return mStrategy; }
+
+    // producer side, after making a record visible
+    void notify ()
+    {
+        if (mStrategy != WAIT_BLOCK)
+            return;
+
+        // pairs with the fence in idle, either the consumer sees the
+        // record or we see it waiting
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&mWaiting, __ATOMIC_RELAXED))
+            wake ();
+    }
+
+    // consumer side, nothing was ready. source.isReady () is checked again
+    // once the consumer has announced it is about to sleep
+    template <typename T>
+    void idle (unsigned int& spins, T& source)
+    {
+        if (mStrategy == WAIT_SPIN || spins++ < kBlockSpinLimit)
+        {
+            cpuRelax ();
+            return;
+        }
+        if (mStrategy == WAIT_YIELD)
+        {
+            yield ();
+            return;
+        }
+        spins = 0;
+
+        sbfMutex_lock (&mMutex);
+        __atomic_store_n (&mWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+        if (!source.isReady () && !isStopped ())
+            timedWait ();
+
+        __atomic_store_n (&mWaiting, 0, __ATOMIC_RELAXED);
+        sbfMutex_unlock (&mMutex);
+    }
+
+    void stop ();
+
+    bool isStopped () const
+    {
+        return __atomic_load_n (&mStopped, __ATOMIC_ACQUIRE);
+    }
+
+    // producer side, the ring is full
+    void backoff (unsigned int& spins);
+
+    static void cpuRelax ()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __asm__ __volatile__ ("pause");
+#endif
+    }
+
+    // give up the rest of this thread's time slice
+    static void yield ()
+    {
+        sched_yield ();
+    }
+
+    static bool parseStrategy (const string& value, strategy& s);
+
+private:
+    logWaiter (const logWaiter& that);
+    void operator= (const logWaiter& that);
+
+    // spins before a blocking consumer parks
+    static const unsigned int kBlockSpinLimit = 128;
+
+    void wake ();
+
+    void timedWait ();
+
+    strategy        mStrategy;
+
+    char            mPad0[64];
+    volatile int    mWaiting;
+    volatile bool   mStopped;
+    char            mPad1[64];
+
+    sbfMutex        mMutex;
+    sbfCondVar      mCond;
+};
+
+};
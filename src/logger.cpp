@@ -4,26 +4,239 @@
 
 #include <logger.h>
 #include <sbfCommon.h>
+#include "logArgs.h"
+#include "logClock.h"
+#include "logEpoch.h"
+#include "logHandlerSet.h"
+#include "logHandlerWorker.h"
+#include "logQueue.h"
+#include "logRecord.h"
+#include "logRegistry.h"
+#include "logStaging.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
 
+#include <pthread.h>
+
 namespace neueda
 {
-struct logWorkItem
+// per thread buffer vlog formats into, sized for a chunk and only grown
+// when a message does not fit
+struct logScratch
+{
+    char*   mData;
+    size_t  mSize;
+    bool    mInUse;
+};
+
+static __thread logScratch* tlsScratch = NULL;
+
+static pthread_key_t  scratchKey;
+static pthread_once_t scratchKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+freeScratch (void* closure)
+{
+    logScratch* scratch = static_cast<logScratch*>(closure);
+    delete [] scratch->mData;
+    delete scratch;
+}
+
+static void
+createScratchKey ()
+{
+    pthread_key_create (&scratchKey, freeScratch);
+}
+
+static logScratch*
+getScratch ()
+{
+    if (tlsScratch == NULL)
+    {
+        logScratch* scratch = new logScratch;
+        scratch->mSize = defaultLogMessageChunkSize + 1;
+        scratch->mData = new char[scratch->mSize];
+        scratch->mInUse = false;
+
+        // release the buffer when the thread exits
+        pthread_once (&scratchKeyOnce, createScratchKey);
+        pthread_setspecific (scratchKey, scratch);
+        tlsScratch = scratch;
+    }
+
+    return tlsScratch;
+}
+
+// growable buffer behind the per thread streams, cleared between lines
+// without giving its memory back
+class logStreamBuf : public std::streambuf
+{
+public:
+    logStreamBuf () : mBuffer (256)
+    {
+        reset ();
+    }
+
+    void reset ()
+    {
+        setp (&mBuffer[0], &mBuffer[0] + mBuffer.size ());
+    }
+
+    const char* data () const { return pbase (); }
+
+    size_t size () const { return pptr () - pbase (); }
+
+protected:
+    int_type overflow (int_type c)
+    {
+        grow (1);
+        if (!traits_type::eq_int_type (c, traits_type::eof ()))
+        {
+            *pptr () = traits_type::to_char_type (c);
+            pbump (1);
+        }
+        return traits_type::not_eof (c);
+    }
+
+    std::streamsize xsputn (const char* s, std::streamsize n)
+    {
+        if (epptr () - pptr () < n)
+            grow (n);
+        memcpy (pptr (), s, n);
+        pbump ((int)n);
+        return n;
+    }
+
+private:
+    void grow (size_t needed)
+    {
+        size_t used = size ();
+        size_t capacity = mBuffer.size ();
+        while (capacity - used < needed)
+            capacity *= 2;
+
+        mBuffer.resize (capacity);
+        setp (&mBuffer[0], &mBuffer[0] + capacity);
+        pbump ((int)used);
+    }
+
+    std::vector<char>   mBuffer;
+};
+
+// a thread's line under construction for one logger
+struct logStreamState
+{
+    logStreamState (const logger* owner, logSeverity::level level) :
+        mOwner (owner),
+        mLevel (level),
+        mEnabled (owner->isLevelEnabled (level)),
+        mStream (&mBuffer)
+    {
+    }
+
+    const logger*       mOwner;
+    logSeverity::level  mLevel;
+    bool                mEnabled;
+    logStreamBuf        mBuffer;
+    std::ostream        mStream;
+};
+
+struct logStreamCache
 {
-    logService*        mService;
-    logSeverity::level mSeverity;
-    char               mName[64];
-    uint64_t           mTime;
-    char               mMessage[defaultLogMessageChunkSize];
-    size_t             mMessageLen;
+    ~logStreamCache ()
+    {
+        for (size_t i = 0; i < mStates.size (); i++)
+            delete mStates[i];
+    }
+
+    std::vector<logStreamState*>    mStates;
+    logStreamState*                 mLast;
 };
 
+static __thread logStreamCache* tlsStreams = NULL;
+
+static pthread_key_t  streamsKey;
+static pthread_once_t streamsKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+freeStreams (void* closure)
+{
+    delete static_cast<logStreamCache*>(closure);
+}
+
+static void
+createStreamsKey ()
+{
+    pthread_key_create (&streamsKey, freeStreams);
+}
+
+static logStreamState*
+getStreamState (const logger* owner)
+{
+    logStreamCache* cache = tlsStreams;
+    if (cache == NULL)
+    {
+        cache = new logStreamCache;
+        cache->mLast = NULL;
+
+        pthread_once (&streamsKeyOnce, createStreamsKey);
+        pthread_setspecific (streamsKey, cache);
+        tlsStreams = cache;
+    }
+
+    if (cache->mLast != NULL && cache->mLast->mOwner == owner)
+        return cache->mLast;
+
+    logStreamState* state = NULL;
+    for (size_t i = 0; i < cache->mStates.size (); i++)
+    {
+        if (cache->mStates[i]->mOwner == owner)
+        {
+            state = cache->mStates[i];
+            break;
+        }
+    }
+
+    if (state == NULL)
+    {
+        state = new logStreamState (owner, logSeverity::INFO);
+        cache->mStates.push_back (state);
+    }
+
+    cache->mLast = state;
+    return state;
+}
+
 
 static const logSeverity::level defaultLoggerSeverity = logSeverity::INFO;
+static const string defaultQueueCapacity = "2048";
+static const string defaultQueueBytes = "1048576";
+static const string defaultQueueWait = "block";
+static const string defaultQueueBackend = "mpsc";
+static const string defaultQueueRingSize = "262144";
+static const string defaultQueueOverflow = "block";
+static const string defaultQueueOverflowSeverity = "warn";
+static const string defaultHandlerQueueCapacity = "65536";
+static const string defaultHandlerQueueOverflow = "drop-newest";
+static const string defaultClockSource = "realtime";
 static const string defaultRootSBFLoogerName = "SBF";
+static const string defaultDroppedLoggerName = "logService";
+static const string loggerLevelPrefix = "logger.level.";
+
+// most records the dispatch thread hands to the handlers in one go
+static const size_t dispatchBatchSize = 64;
+
+// async records carry the logger's id, the name only when it has none
+static size_t
+inlineNameLength (const logger* source)
+{
+    if (source->getId () != logRegistry::kNoId)
+        return 0;
+    return std::min (source->getName ().size (), logRecord::kMaxNameLength);
+}
 
 logService* logService::mInstance = NULL;
 
@@ -38,31 +251,32 @@ logService::get()
 
 logService::~logService ()
 {
-    sbfMutex_lock (&mMutex);
-
-    std::map<std::string, logger*>::iterator lit;
-    for (lit = mloggers.begin (); lit != mloggers.end (); ++lit)
-    {
-        logger* l = lit->second;
-        delete l;
-    }
-    mloggers.clear ();
-
-    sbfMutex_unlock (&mMutex);
-
     stopDispatching ();
 
     clearHandlers ();
 
+    // queued records name their logger by id until the end
+    delete mRegistry;
+    delete mHandlerSet;
+    delete mProducers;
     sbfMutex_destroy (&mMutex);
 }
 
 logService::logService ()
-    : mMw (NULL),
-      mQueue (NULL),
+    : mQueue (NULL),
+      mStaging (NULL),
       mDispatching (false),
+      mAccepting (false),
+      mProducers (new logEpoch ()),
       mIsAsync (false),
-      mLevel (defaultLoggerSeverity)
+      mIsDeferred (false),
+      mLevel (defaultLoggerSeverity),
+      mHandlerLevel (logSeverity::FATAL),
+      mRegistry (new logRegistry ()),
+      mHandlerSet (new logHandlerSet ()),
+      mHandlerThreads (false),
+      mHandlerQueueCapacity (0),
+      mHandlerQueueOverflow (logOverflow::OVERFLOW_DROP_NEWEST)
 {
     sbfMutex_init (&mMutex, 1);
     mSbfLog = sbfLog_create (NULL, "sbf"); // can't fail
@@ -74,15 +288,13 @@ logger*
 logService::getLogger (const std::string& name)
 {
     logService& service = logService::get ();
-    logger* l = NULL;
-
-    if (!service.findLogger (name, l))
-    {
-        l = new logger (name, &service, service.mLevel);
-        service.mloggers.insert (std::pair<std::string, logger*> (name, l));
-    }
+    return service.mRegistry->get (name, &service, service.mLevel);
+}
 
-    return l;
+logger*
+logService::getLoggerById (uint32_t id)
+{
+    return logService::get ().mRegistry->find (id);
 }
 
 bool
@@ -97,6 +309,7 @@ logService::addHandler (logHandler* handler,
     {
         mHandlers.insert (handler);
         mHandlerOwnedTable.insert (std::pair<logHandler*, bool>(handler, owned));
+        publishHandlers ();
     }
     else
         errorMessage.assign("failed to setup handler: " + handler->getLastError ());
@@ -111,14 +324,16 @@ logService::removeHandler (logHandler* handler)
 {
     sbfMutex_lock (&mMutex);
 
-    handler->teardown ();
-
     std::map<logHandler*,bool>::iterator it = mHandlerOwnedTable.find(handler);
     bool isOwned = it->second;
 
     mHandlers.erase (handler);
     mHandlerOwnedTable.erase (it);
 
+    // once published nothing is dispatching to it any more
+    publishHandlers ();
+    handler->teardown ();
+
     if (isOwned)
         delete handler;
 
@@ -126,44 +341,49 @@ logService::removeHandler (logHandler* handler)
 }
 
 bool
-logService::init (std::string& errorMessage)
+logService::init (logQueue* queue,
+                  logStaging* staging,
+                  std::string& errorMessage)
 {
-    sbfKeyValue kv = sbfKeyValue_create ();
-    mMw = sbfMw_create (mSbfLog, kv);
-    sbfKeyValue_destroy (kv);
-    if (mMw == NULL)
-    {
-        errorMessage.assign("failed to create mw");
-        return false;
-    }
-    
-    mQueue = sbfQueue_create (mMw, "default");
-    if (mQueue == NULL)
-    {
-        errorMessage.assign ("failed to create queue");
-        return false;
-    }
-    
+    mQueue = queue;
+    mStaging = staging;
+
     // start to dispatch 
     if (sbfThread_create (&mThread, logService::dispatchCb, this) != 0)
     {
         errorMessage.assign ("failed to start dispatch queue");
+        delete mQueue;
+        mQueue = NULL;
+        delete mStaging;
+        mStaging = NULL;
         return false;
     }
 
     mDispatching = true;
+    logAtomic_storeRelease (&mAccepting, true);
     return true;
 }
 
 void
 logService::stopDispatching ()
 {
+    // producers fall back to dispatching themselves, and once those
+    // already enqueueing are done nothing else touches the queue. The
+    // dispatcher keeps draining meanwhile so none is stuck on a full one
+    logAtomic_storeRelease (&mAccepting, false);
+    mProducers->synchronize ();
+
     if (mQueue)
-        sbfQueue_destroy (mQueue);
+        mQueue->stop ();
+    if (mStaging)
+        mStaging->stop ();
     if (mDispatching)
         sbfThread_join (mThread);
-    if (mMw)
-        sbfMw_destroy (mMw);
+
+    delete mQueue;
+    mQueue = NULL;
+    delete mStaging;
+    mStaging = NULL;
 
     mDispatching = false;
 }
@@ -172,10 +392,171 @@ bool
 logService::configure (properties& props,
                        std::string& errorMessage)
 {
-    sbfMutex_lock (&mMutex);
+    // everything is parsed and the new handlers set up before anything
+    // changes, a bad value or a handler that fails leaves the service as
+    // it was
 
-    // clear the slate
-    clearHandlers ();
+    // every handler on a thread of its own
+    string value;
+    bool handlerThreads;
+    props.get ("logger.service.handler.threads", "false", value);
+
+    if (!utils_parseBool (value, handlerThreads))
+    {
+        errorMessage.assign ("failed parsing property: handler.threads");
+        return false;
+    }
+
+    int handlerCapacity = 0;
+    props.get ("logger.service.handler.queue.capacity",
+               defaultHandlerQueueCapacity,
+               value);
+
+    if (!utils_parseNumber (value, handlerCapacity) || handlerCapacity <= 0)
+    {
+        errorMessage.assign ("failed parsing property: handler.queue.capacity");
+        return false;
+    }
+
+    // a full handler queue drops rather than hold up the other handlers,
+    // unless told to block
+    logOverflow::policy handlerOverflow;
+    props.get ("logger.service.handler.queue.overflow",
+               defaultHandlerQueueOverflow,
+               value);
+
+    if (!logOverflow::parsePolicy (value, handlerOverflow)
+        || (handlerOverflow != logOverflow::OVERFLOW_BLOCK
+            && handlerOverflow != logOverflow::OVERFLOW_DROP_NEWEST))
+    {
+        errorMessage.assign ("failed parsing property: handler.queue.overflow");
+        return false;
+    }
+
+    // where loggers take their timestamps from, falls back to the
+    // realtime clock when the tsc cannot be used
+    logClock::source clock;
+    props.get ("logger.service.clock", defaultClockSource, value);
+
+    if (!logClock::parseSource (value, clock))
+    {
+        errorMessage.assign ("failed parsing property: clock");
+        return false;
+    }
+
+    // logger.level.<pattern>, see setLevel
+    std::map<std::string, logSeverity::level> rules;
+    properties::const_iterator pit;
+    for (pit = props.begin (); pit != props.end (); ++pit)
+    {
+        const std::string& key = pit->first;
+        if (key.compare (0, loggerLevelPrefix.size (), loggerLevelPrefix) != 0)
+            continue;
+
+        logSeverity::level level;
+        std::string pattern = key.substr (loggerLevelPrefix.size ());
+        if (pattern.empty ()
+            || !logHandlerFactory::propertyValueToSeverity (pit->second,
+                                                             level,
+                                                             errorMessage))
+        {
+            errorMessage.assign ("failed parsing property: " + key);
+            return false;
+        }
+        rules[pattern] = level;
+    }
+
+    // is aync mode
+    bool isAsync;
+    props.get ("logger.service.async", "false", value);
+
+    if (!utils_parseBool (value, isAsync))
+    {
+        // failed to parse bool from a user configured value
+        errorMessage.assign ("failed parsing property: enabled for async");
+        return false;
+    }
+
+    // is deferred formatting mode
+    bool isDeferred;
+    props.get ("logger.service.deferred", "false", value);
+
+    if (!utils_parseBool (value, isDeferred))
+    {
+        errorMessage.assign ("failed parsing property: enabled for deferred");
+        return false;
+    }
+
+    // async queue sizing and consumer wakeup
+    int capacity = 0;
+    props.get ("logger.service.queue.capacity", defaultQueueCapacity, value);
+
+    if (!utils_parseNumber (value, capacity) || capacity <= 0)
+    {
+        errorMessage.assign ("failed parsing property: queue.capacity");
+        return false;
+    }
+
+    int bytes = 0;
+    props.get ("logger.service.queue.bytes", defaultQueueBytes, value);
+
+    if (!utils_parseNumber (value, bytes) || bytes <= 0)
+    {
+        errorMessage.assign ("failed parsing property: queue.bytes");
+        return false;
+    }
+
+    logWaiter::strategy wait;
+    props.get ("logger.service.queue.wait", defaultQueueWait, value);
+
+    if (!logWaiter::parseStrategy (value, wait))
+    {
+        errorMessage.assign ("failed parsing property: queue.wait");
+        return false;
+    }
+
+    // shared mpsc queue or per thread spsc staging rings
+    bool isStaged;
+    props.get ("logger.service.queue.backend", defaultQueueBackend, value);
+
+    if (value == "mpsc")
+        isStaged = false;
+    else if (value == "spsc")
+        isStaged = true;
+    else
+    {
+        errorMessage.assign ("failed parsing property: queue.backend");
+        return false;
+    }
+
+    int ringSize = 0;
+    props.get ("logger.service.queue.ring.size", defaultQueueRingSize, value);
+
+    if (!utils_parseNumber (value, ringSize) || ringSize <= 0)
+    {
+        errorMessage.assign ("failed parsing property: queue.ring.size");
+        return false;
+    }
+
+    // what producers do when the async queue is full
+    logOverflow::policy overflow;
+    props.get ("logger.service.queue.overflow", defaultQueueOverflow, value);
+
+    if (!logOverflow::parsePolicy (value, overflow))
+    {
+        errorMessage.assign ("failed parsing property: queue.overflow");
+        return false;
+    }
+
+    logSeverity::level dropBelow;
+    props.get ("logger.service.queue.overflow.severity",
+               defaultQueueOverflowSeverity,
+               value);
+
+    if (!logHandlerFactory::propertyValueToSeverity (value,
+                                                     dropBelow,
+                                                     errorMessage))
+        return false;
 
     bool ok;
     std::set<logHandler*> handlers = logHandlerFactory::getHandlers (props,
@@ -183,13 +564,13 @@ logService::configure (properties& props,
                                                                      errorMessage);
     if (!ok)
     {
-        std::set<logHandler*>::iterator it;
-        for (it = mHandlers.begin (); it != mHandlers.end (); ++it)
-            delete *it;
-
+        deleteHandlers (handlers, handlers.begin ());
         return false;
     }
 
+    sbfMutex_lock (&mMutex);
+
+    // the new handlers are ready before the old ones go
     std::set<logHandler*>::iterator it;
     for (it = handlers.begin (); it != handlers.end (); ++it)
     {
@@ -197,37 +578,75 @@ logService::configure (properties& props,
 
         if (!handle->setup ())
         {
-            // delete all pending handlers and fall back to caller
-            std::set<logHandler*>::iterator itt;
-            for (itt = mHandlers.begin (); itt != mHandlers.end (); ++itt)
-                delete *itt;
-
-            mHandlerOwnedTable.clear ();
+            errorMessage.assign ("failed to setup handler: "
+                                 + handle->getLastError ());
+            deleteHandlers (handlers, it);
+            sbfMutex_unlock (&mMutex);
             return false;
         }
-
-        mHandlerOwnedTable.insert (std::pair<logHandler*, bool>(handle, true));
     }
 
+    // clear the slate
+    clearHandlers ();
+
+    mHandlerThreads = handlerThreads;
+    mHandlerQueueCapacity = handlerCapacity;
+    mHandlerQueueOverflow = handlerOverflow;
+    mIsAsync = isAsync;
+    mIsDeferred = isDeferred;
+
+    if (clock != logClock::getSource ())
+        logClock::setSource (clock);
+
+    // rules dropped from the properties go too
+    mRegistry->setLevels (rules, getHandlerLevel ());
+
     // set the handlers
+    for (it = handlers.begin (); it != handlers.end (); ++it)
+        mHandlerOwnedTable.insert (std::pair<logHandler*, bool>(*it, true));
     mHandlers = handlers;
+    publishHandlers ();
 
-    // is aync mode
-    string value;
-    props.get ("logger.service.async", "false", value);
-
-    if (!utils_parseBool (value, mIsAsync))
+    if (mIsAsync && mDispatching)
     {
-        // failed to parse bool from a user configured value
-        errorMessage.assign ("failed parsing property: enabled for async");
-        return false;
+        bool restart;
+        if (isStaged)
+        {
+            restart = mStaging == NULL
+                || mStaging->getRingSize () < (size_t)ringSize
+                || mStaging->getWaitStrategy () != wait
+                || mStaging->getOverflow ().getPolicy () != overflow
+                || mStaging->getOverflow ().getLevel () != dropBelow;
+        }
+        else
+        {
+            restart = mQueue == NULL
+                || mQueue->getCapacity () != (size_t)capacity
+                || mQueue->getSize () < (size_t)bytes
+                || mQueue->getWaitStrategy () != wait
+                || mQueue->getOverflow ().getPolicy () != overflow
+                || mQueue->getOverflow ().getLevel () != dropBelow;
+        }
+
+        // restart with the new queue settings
+        if (restart)
+            stopDispatching ();
     }
 
     if (mIsAsync && !mDispatching)
     {
-        // failed to init service
-        if (!init (errorMessage))
-            return false;
+        if (isStaged)
+        {
+            ok = init (NULL,
+                       new logStaging (ringSize, wait, overflow, dropBelow),
+                       errorMessage);
+        }
+        else
+        {
+            ok = init (new logQueue (bytes, capacity, wait, overflow, dropBelow),
+                       NULL,
+                       errorMessage);
+        }
     }
     else if (!mIsAsync && mDispatching)
     {
@@ -236,8 +655,149 @@ logService::configure (properties& props,
     }
 
     sbfMutex_unlock (&mMutex);
-    
-    return true;
+
+    // failed to init service
+    return ok;
+}
+
+void
+logService::deleteHandlers (std::set<logHandler*>& handlers,
+                            std::set<logHandler*>::iterator notSetUp)
+{
+    bool setUp = true;
+    std::set<logHandler*>::iterator it;
+    for (it = handlers.begin (); it != handlers.end (); ++it)
+    {
+        if (it == notSetUp)
+            setUp = false;
+        if (setUp)
+            (*it)->teardown ();
+        delete *it;
+    }
+    handlers.clear ();
+}
+
+void
+logService::publishHandlers ()
+{
+    std::set<logHandler*> published;
+    std::set<logHandler*>::iterator it;
+    for (it = mHandlers.begin (); it != mHandlers.end (); ++it)
+    {
+        logHandler* handler = *it;
+        if (!mHandlerThreads)
+        {
+            published.insert (handler);
+            continue;
+        }
+
+        std::map<logHandler*, logHandlerWorker*>::iterator wit =
+            mWorkers.find (handler);
+        if (wit != mWorkers.end ())
+        {
+            published.insert (wit->second);
+            continue;
+        }
+
+        // no thread to be had, it is called on the dispatcher instead
+        logHandlerWorker* worker =
+            new logHandlerWorker (handler,
+                                  mHandlerQueueCapacity,
+                                  (logOverflow::policy)mHandlerQueueOverflow);
+        if (worker->start ())
+        {
+            mWorkers.insert (std::make_pair (handler, worker));
+            published.insert (worker);
+        }
+        else
+        {
+            delete worker;
+            published.insert (handler);
+        }
+    }
+    mHandlerSet->publish (published);
+    publishLevel ();
+
+    // workers left out of the set finish what they have queued and go
+    std::map<logHandler*, logHandlerWorker*>::iterator wit = mWorkers.begin ();
+    while (wit != mWorkers.end ())
+    {
+        if (mHandlerThreads && mHandlers.count (wit->first) > 0)
+        {
+            ++wit;
+            continue;
+        }
+
+        delete wit->second;
+        mWorkers.erase (wit++);
+    }
+}
+
+void
+logService::publishLevel ()
+{
+    logSeverity::level level = logSeverity::FATAL;
+    std::set<logHandler*>::iterator it;
+    for (it = mHandlers.begin (); it != mHandlers.end (); ++it)
+    {
+        if ((*it)->getLevel () < level)
+            level = (*it)->getLevel ();
+    }
+
+    // loggers created from here on start with the new level, the rest
+    // are brought up to date
+    logAtomic_storeRelease (&mHandlerLevel, level);
+    mRegistry->refreshThresholds (level);
+}
+
+void
+logService::setLevel (const std::string& pattern, logSeverity::level lvl)
+{
+    // serialised with publishing a new handler level
+    sbfMutex_lock (&mMutex);
+    mRegistry->setLevel (pattern, lvl, getHandlerLevel ());
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+logService::handlerLevelChanged ()
+{
+    logService* service = mInstance;
+    if (service == NULL)
+        return;
+
+    sbfMutex_lock (&service->mMutex);
+    service->publishLevel ();
+    sbfMutex_unlock (&service->mMutex);
+}
+
+void
+logService::stopWorkers ()
+{
+    std::map<logHandler*, logHandlerWorker*>::iterator it;
+    for (it = mWorkers.begin (); it != mWorkers.end (); ++it)
+        delete it->second;
+    mWorkers.clear ();
+}
+
+bool
+logService::getHandlerStats (logHandler* handler, logHandlerStats& stats)
+{
+    sbfMutex_lock (&mMutex);
+
+    std::map<logHandler*, logHandlerWorker*>::iterator it =
+        mWorkers.find (handler);
+    bool found = it != mWorkers.end ();
+    if (found)
+    {
+        stats.mDepth = it->second->getDepth ();
+        stats.mLag = it->second->getLag ();
+        stats.mDropped = it->second->getDropped ();
+    }
+
+    sbfMutex_unlock (&mMutex);
+
+    return found;
 }
 
 void
@@ -245,6 +805,10 @@ logService::clearHandlers ()
 {
     sbfMutex_lock (&mMutex);
 
+    // stop dispatching to them before they go
+    mHandlerSet->publish (std::set<logHandler*> ());
+    stopWorkers ();
+
     std::set<logHandler*>::iterator it;
     for (it = mHandlers.begin (); it != mHandlers.end (); ++it)
     {
@@ -259,6 +823,7 @@ logService::clearHandlers ()
     }
     mHandlers.clear ();
     mHandlerOwnedTable.clear ();
+    publishLevel ();
 
     sbfMutex_unlock (&mMutex);
 }
@@ -269,81 +834,397 @@ logService::handle (const std::string& logger,
                     uint64_t time,
                     const char* message,
                     size_t messageLen)
-{    
-    logWorkItem* item = new logWorkItem();
-    
-    item->mService = this;
-    item->mSeverity = severity;
-    item->mTime = time;
+{
+    handle (getLogger (logger), severity, time, message, messageLen);
+}
 
-    size_t nameCopySize = (logger.size () > sizeof (item->mName)) ?
-        sizeof (item->mName) :
-        logger.size ();
-    strncpy (item->mName, logger.c_str (), nameCopySize);
+void
+logService::handle (const logger* source,
+                    logSeverity::level severity,
+                    uint64_t time,
+                    const char* message,
+                    size_t messageLen)
+{
+    if (mIsAsync && enqueue (source, severity, time, message, messageLen))
+        return;
+
+    dispatch (severity,
+              source->getName ().c_str (),
+              logClock::toNanos (time),
+              message,
+              messageLen);
+}
 
-    size_t msgCopySize = (messageLen > sizeof (item->mMessage)) ?
-        sizeof (item->mMessage) :
-        messageLen;
-    strncpy (item->mMessage, message, msgCopySize);
-    item->mMessageLen = msgCopySize;
+bool
+logService::enqueue (const logger* source,
+                     logSeverity::level severity,
+                     uint64_t time,
+                     const char* message,
+                     size_t messageLen)
+{
+    // the queue is not deleted while this is held, see stopDispatching
+    logEpoch::guard producing (*mProducers);
+    if (!logAtomic_loadAcquire (&mAccepting))
+        return false;
 
-    if (mIsAsync && mQueue != NULL)
+    logStaging* staging = mStaging;
+    logQueue* queue = mQueue;
+
+    // messages travel as one record unless they outgrow what the queue
+    // can take in one go
+    size_t limit = staging != NULL ?
+        staging->maxRecordSize () :
+        queue->maxRecordSize ();
+    size_t chunk = limit - logRecord::sizeFor (inlineNameLength (source), 0);
+
+    size_t offset = 0;
+    do
     {
-        sbfQueue_enqueue (mQueue, logService::asyncHandle, item);
+        size_t chunkSize = std::min (messageLen - offset, chunk);
+        if (staging != NULL)
+        {
+            staging->write (source->getId (),
+                            source->getName (),
+                            severity,
+                            time,
+                            message + offset,
+                            chunkSize);
+        }
+        else
+        {
+            enqueue (queue,
+                     source,
+                     severity,
+                     time,
+                     message + offset,
+                     chunkSize);
+        }
+        offset += chunkSize;
+    } while (offset < messageLen);
+
+    return true;
+}
+
+void
+logService::enqueue (logQueue* queue,
+                     const logger* source,
+                     logSeverity::level severity,
+                     uint64_t time,
+                     const char* message,
+                     size_t messageLen)
+{
+    size_t nameLen = inlineNameLength (source);
+    size_t length = logRecord::sizeFor (nameLen, messageLen);
+
+    logRecord* record = queue->claim (length, severity);
+    if (record == NULL)
+        return;
+
+    char* body = record->init (source->getId (),
+                               source->getName ().c_str (),
+                               nameLen,
+                               severity,
+                               time);
+    memcpy (body, message, messageLen);
+
+    queue->publish (record, length, record->finish (messageLen));
+}
+
+void
+logService::getPoolStats (logPoolStats& stats)
+{
+    memset (&stats, 0, sizeof stats);
+
+    sbfMutex_lock (&mMutex);
+    if (mStaging != NULL)
+        mStaging->getPoolStats (stats);
+    sbfMutex_unlock (&mMutex);
+}
+
+bool
+logService::handleDeferred (const logger* source,
+                            logSeverity::level severity,
+                            uint64_t time,
+                            const char* fmt,
+                            va_list ap)
+{
+    if (!mIsAsync)
+        return false;
+
+    logEpoch::guard producing (*mProducers);
+    if (!logAtomic_loadAcquire (&mAccepting))
+        return false;
+
+    logStaging* staging = mStaging;
+    if (staging != NULL)
+    {
+        return staging->writeDeferred (source->getId (),
+                                       source->getName (),
+                                       severity,
+                                       time,
+                                       fmt,
+                                       ap);
     }
-    else
-        logService::asyncHandle (NULL, item);
+
+    logQueue* queue = mQueue;
+    if (queue == NULL)
+        return false;
+
+    // claim enough for the encoded arguments, what is left over is given
+    // back as padding
+    size_t nameLen = inlineNameLength (source);
+    size_t claimed = logRecord::sizeFor (nameLen, defaultLogMessageChunkSize);
+
+    logRecord* record = queue->claim (claimed, severity);
+
+    // dropped, there is nothing left for the caller to do
+    if (record == NULL)
+        return true;
+
+    char* body = record->init (source->getId (),
+                               source->getName ().c_str (),
+                               nameLen,
+                               severity,
+                               time);
+
+    size_t length = 0;
+    if (!logArgs::encode (fmt, ap, body, defaultLogMessageChunkSize, length))
+    {
+        // not replayable, let the caller format eagerly
+        queue->abandon (record, claimed);
+        return false;
+    }
+
+    record->mFormat = fmt;
+    queue->publish (record, claimed, record->finish (length));
+    return true;
 }
 
 void*
 logService::dispatchCb (void* closure)
 {
     logService* self = reinterpret_cast<logService*>(closure);
-    sbfQueue_dispatch (self->mQueue);
+    const logRecord* records[dispatchBatchSize];
+    size_t count;
+
+    // a short batch means the consumer has caught up, a good point to say
+    // what was lost before the batch was taken
+    uint64_t dropped;
+    logStaging* staging = self->mStaging;
+    if (staging != NULL)
+    {
+        logOverflow& overflow = staging->getOverflow ();
+        dropped = overflow.getDropped ();
+        while ((count = staging->takeBatch (records, dispatchBatchSize)) > 0)
+        {
+            self->asyncHandle (records, count);
+            staging->releaseBatch ();
+
+            if (count < dispatchBatchSize)
+                self->reportDropped (overflow, dropped);
+            dropped = overflow.getDropped ();
+        }
+        self->reportDropped (overflow, overflow.getDropped ());
+        return NULL;
+    }
+
+    logQueue* queue = self->mQueue;
+    logOverflow& overflow = queue->getOverflow ();
+    dropped = overflow.getDropped ();
+    while ((count = queue->takeBatch (records, dispatchBatchSize)) > 0)
+    {
+        self->asyncHandle (records, count);
+        queue->releaseBatch ();
+
+        if (count < dispatchBatchSize)
+            self->reportDropped (overflow, dropped);
+        dropped = overflow.getDropped ();
+    }
+    self->reportDropped (overflow, overflow.getDropped ());
     return NULL;
 }
-    
+
 void
-logService::asyncHandle (sbfQueueItem item, void* closure)
+logService::reportDropped (logOverflow& overflow, uint64_t dropped)
 {
-    logWorkItem* workItem = static_cast<logWorkItem*>(closure);
-    logService* self = workItem->mService;
+    uint64_t count = overflow.takeUnreported (dropped);
+    if (count == 0)
+        return;
 
-    sbfMutex_lock (&self->mMutex);
+    char message[64];
+    int len = snprintf (message,
+                        sizeof message,
+                        "%llu records dropped",
+                        (unsigned long long)count);
+    dispatch (logSeverity::WARN,
+              defaultDroppedLoggerName.c_str (),
+              logClock::toNanos (logClock::now ()),
+              message,
+              len);
+}
 
-    std::set<logHandler*>::iterator it;
-    for (it = self->mHandlers.begin (); it != self->mHandlers.end (); ++it)
+uint64_t
+logService::getDropped ()
+{
+    uint64_t dropped = 0;
+
+    sbfMutex_lock (&mMutex);
+    if (mStaging != NULL)
+        dropped = mStaging->getOverflow ().getDropped ();
+    else if (mQueue != NULL)
+        dropped = mQueue->getOverflow ().getDropped ();
+    sbfMutex_unlock (&mMutex);
+
+    return dropped;
+}
+
+void
+logService::asyncHandle (const logRecord* const* records, size_t count)
+{
+    // only ever called on the dispatch thread. Deferred records are
+    // rendered into mDeferredBuffer, which may move as it grows, so
+    // entries are pointed at it once the batch is complete
+    for (size_t i = 0; i < count; i++)
     {
-        logHandler* const handle = *it;
-        if (!handle->isLevelEnabled (workItem->mSeverity))
+        const logRecord* record = records[i];
+        // resolved through the registry unless the name came inline
+        const char* name = record->getName ();
+        if (record->mLoggerId != logRegistry::kNoId)
+            name = mRegistry->find (record->mLoggerId)->getName ().c_str ();
+
+        logBatchEntry entry = { record->getSeverity (),
+                                name,
+                                logClock::toNanos (record->mTime),
+                                record->getMessage (),
+                                record->mMessageLen };
+
+        if (record->mFormat != NULL)
+        {
+            size_t position = mDeferredBuffer.size ();
+            logArgs::render (mDeferredBuffer,
+                             record->mFormat,
+                             record->getMessage (),
+                             record->mMessageLen);
+            entry.mMessage = NULL;
+            entry.mMessageLen = mDeferredBuffer.size () - position;
+
+            // terminated for the handlers like any other message
+            mDeferredBuffer.push_back ('\0');
+            mBatchOffsets.push_back (position);
+        }
+        mBatch.push_back (entry);
+    }
+
+    dispatchBatch ();
+}
+
+void
+logService::dispatchBatch ()
+{
+    if (mBatch.empty ())
+        return;
+
+    size_t deferred = 0;
+    for (size_t i = 0; i < mBatch.size (); i++)
+    {
+        if (mBatch[i].mMessage != NULL)
+            continue;
+
+        mBatch[i].mMessage = mDeferredBuffer.data ()
+            + mBatchOffsets[deferred++];
+    }
+
+    // handler workers all share one copy of the batch
+    logSharedBatch* shared = NULL;
+
+    // a handler that changed the set may have torn the rest down
+    logHandlerSet::reader handlers (*mHandlerSet);
+    for (size_t i = 0; i < handlers.size () && !handlers.isRetired (); i++)
+    {
+        logHandlerWorker* worker = dynamic_cast<logHandlerWorker*>(handlers[i]);
+        if (worker == NULL)
+        {
+            handlers[i]->handleBatch (&mBatch[0], mBatch.size ());
             continue;
+        }
 
-        handle->handle (workItem->mSeverity,
-                        workItem->mName,
-                        workItem->mTime,
-                        workItem->mMessage,
-                        workItem->mMessageLen);
+        if (shared == NULL)
+            shared = logSharedBatch::create (&mBatch[0], mBatch.size ());
+        post (worker, shared);
     }
+    if (shared != NULL)
+        shared->unref ();
 
-    delete workItem;
-    
-    sbfMutex_unlock (&self->mMutex);
+    mBatch.clear ();
+    mBatchOffsets.clear ();
+    mDeferredBuffer.clear ();
 }
-    
 
-bool
-logService::findLogger (std::string name, logger*& l)
+void
+logService::dispatch (logSeverity::level severity,
+                      const char* name,
+                      uint64_t time,
+                      const char* message,
+                      size_t messageLen)
 {
-    std::map<std::string, logger*>::iterator foundIterator = mloggers.find (name);
-    bool found = foundIterator != mloggers.end ();
+    // handler workers all share one copy of the record
+    logSharedBatch* shared = NULL;
 
-    if (found) 
+    // a handler that changed the set may have torn the rest down
+    logHandlerSet::reader handlers (*mHandlerSet);
+    for (size_t i = 0; i < handlers.size () && !handlers.isRetired (); i++)
     {
-        l = foundIterator->second;
-        return true;
+        logHandler* const handle = handlers[i];
+        if (!handle->isLevelEnabled (severity))
+            continue;
+
+        logHandlerWorker* worker = dynamic_cast<logHandlerWorker*>(handle);
+        if (worker == NULL)
+        {
+            handle->handle (severity,
+                            name,
+                            time,
+                            message,
+                            messageLen);
+            continue;
+        }
+
+        if (shared == NULL)
+        {
+            logBatchEntry entry = { severity, name, time, message, messageLen };
+            shared = logSharedBatch::create (&entry, 1);
+        }
+        post (worker, shared);
     }
+    if (shared != NULL)
+        shared->unref ();
+}
 
-    return false;
+void
+logService::post (logHandlerWorker* worker, logSharedBatch* batch)
+{
+    if (!worker->post (batch))
+        return;
+
+    uint64_t count = worker->takeUnreported ();
+    if (count == 0)
+        return;
+
+    // only for this handler, the others have had everything
+    char message[64];
+    logBatchEntry entry;
+    entry.mSeverity = logSeverity::WARN;
+    entry.mName = defaultDroppedLoggerName.c_str ();
+    entry.mTime = logClock::toNanos (logClock::now ());
+    entry.mMessage = message;
+    entry.mMessageLen = snprintf (message,
+                                  sizeof message,
+                                  "%llu records dropped",
+                                  (unsigned long long)count);
+
+    logSharedBatch* report = logSharedBatch::create (&entry, 1);
+    worker->post (report);
+    report->unref ();
 }
 
 int
@@ -373,24 +1254,31 @@ logService::sbfLogCb (sbfLog l, sbfLogLevel level, const char* message, void* cl
 
 logger::logger (const std::string name,
                 logService* const service,
-                logSeverity::level level) : 
+                logSeverity::level level,
+                uint32_t id) :
     mName (name),
     mService (service),
-    mLevel (level)
+    mDefaultLevel (level),
+    mLevel (level),
+    mThreshold (level),
+    mGeneration (0),
+    mId (id)
 {
-    sbfMutex_init (&mStreamMutex, 0);
 }
 
-bool
-logger::isLevelEnabled (logSeverity::level level) const
+void
+logger::setLevel (logSeverity::level level)
 {
-    return mLevel <= level;
+    mService->setLevel (mName, level);
 }
 
 void
-logger::setLevel (logSeverity::level level)
+logger::refreshThreshold (logSeverity::level handlerLevel)
 {
-    mLevel = level;
+    logSeverity::level threshold = mLevel;
+    if (handlerLevel > threshold)
+        threshold = handlerLevel;
+    logAtomic_storeRelaxed (&mThreshold, threshold);
 }
 
 logSeverity::level
@@ -402,6 +1290,9 @@ logger::getLevel () const
 void
 logger::err (const char* fmt, ...)
 {
+    if (!isLevelEnabled (logSeverity::ERROR))
+        return;
+
     va_list ap;
 
     va_start (ap, fmt);
@@ -412,6 +1303,9 @@ logger::err (const char* fmt, ...)
 void
 logger::warn (const char* fmt, ...)
 {
+    if (!isLevelEnabled (logSeverity::WARN))
+        return;
+
     va_list ap;
 
     va_start (ap, fmt);
@@ -422,6 +1316,9 @@ logger::warn (const char* fmt, ...)
 void
 logger::info (const char* fmt, ...)
 {
+    if (!isLevelEnabled (logSeverity::INFO))
+        return;
+
     va_list ap;
 
     va_start (ap, fmt);
@@ -432,6 +1329,9 @@ logger::info (const char* fmt, ...)
 void
 logger::debug (const char* fmt, ...)
 {
+    if (!isLevelEnabled (logSeverity::DEBUG))
+        return;
+
     va_list ap;
 
     va_start (ap, fmt);
@@ -442,6 +1342,9 @@ logger::debug (const char* fmt, ...)
 void
 logger::trace (const char* fmt, ...)
 {
+    if (!isLevelEnabled (logSeverity::TRACE))
+        return;
+
     va_list ap;
 
     va_start (ap, fmt);
@@ -472,63 +1375,141 @@ logger::log (logSeverity::level level,
     va_end (ap);
 }
 
+void
+logger::logLimited (logSeverity::level level,
+                    uint64_t suppressed,
+                    const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    vlog (level, fmt, ap, suppressed);
+    va_end (ap);
+}
+
 void
 logger::vlog (logSeverity::level level,
               const char* fmt,
               va_list ap)
+{
+    vlog (level, fmt, ap, 0);
+}
+
+void
+logger::vlog (logSeverity::level level,
+              const char* fmt,
+              va_list ap,
+              uint64_t suppressed)
 {
     if (!isLevelEnabled (level))
         return;
   
-    timeval tv;
-    gettimeofday (&tv, NULL);
+    uint64_t time = logClock::now ();
+
+    // a count to append has to be formatted here
+    char note[48];
+    size_t noteLen = 0;
+    if (suppressed > 0)
+    {
+        noteLen = snprintf (note,
+                            sizeof note,
+                            " (%llu suppressed)",
+                            (unsigned long long)suppressed);
+    }
+
+    if (mService->mIsDeferred && noteLen == 0)
+    {
+        va_list cp;
+        va_copy (cp, ap);
+        bool deferred = mService->handleDeferred (this,
+                                                  level,
+                                                  time,
+                                                  fmt,
+                                                  cp);
+        va_end (cp);
+
+        if (deferred)
+            return;
+    }
 
-    uint64_t timeInMicros = 1000000 * tv.tv_sec + tv.tv_usec;
+    logScratch* scratch = getScratch ();
+    logScratch overflow;
+
+    // a handler logging from within handle on this thread would otherwise
+    // overwrite the message it is being passed
+    if (scratch->mInUse)
+    {
+        overflow.mSize = 0;
+        overflow.mData = NULL;
+        overflow.mInUse = false;
+        scratch = &overflow;
+    }
 
     va_list cp;
     va_copy (cp, ap);
+    int rc = vsnprintf (scratch->mData, scratch->mSize, fmt, cp);
+    va_end (cp);
 
-    size_t bufsize = vsnprintf (NULL, 0, fmt, cp) + 1;
-    char* s        = new char[bufsize];
-    size_t length  = vsnprintf (s, bufsize, fmt, ap);
-    size_t offset  = 0;
+    if (rc < 0)
+        return;
 
-    if (length <= defaultLogMessageChunkSize)
+    size_t length = rc;
+    if (length + noteLen >= scratch->mSize)
     {
-        mService->handle (getName (),
-                          level,
-                          timeInMicros,
-                          s,
-                          length);
+        delete [] scratch->mData;
+        scratch->mSize = length + noteLen + 1;
+        scratch->mData = new char[scratch->mSize];
+        vsnprintf (scratch->mData, scratch->mSize, fmt, ap);
     }
-    else
+
+    if (noteLen > 0)
     {
-        do
-        {
-            size_t chunkSize = std::min (length - offset,
-                                         defaultLogMessageChunkSize);
-            mService->handle (getName (),
-                              level,
-                              timeInMicros,
-                              s+offset,
-                              chunkSize);
-            offset += chunkSize;
-        } while (offset < length);
+        memcpy (scratch->mData + length, note, noteLen + 1);
+        length += noteLen;
     }
 
-    delete [] s;
+    scratch->mInUse = true;
+    write (level, time, scratch->mData, length);
+
+    scratch->mInUse = false;
+    if (scratch == &overflow)
+        delete [] overflow.mData;
 }
 
 void
-logger::endl (logger& l)
+logger::write (logSeverity::level level,
+               uint64_t time,
+               const char* message,
+               size_t messageLen)
+{
+    mService->handle (this, level, time, message, messageLen);
+}
+
+std::ostream*
+logger::getStream ()
 {
-    sbfMutex_lock (&l.mStreamMutex);
-    l.log (l.mStreamLevel, "%s", l.mStream.str ().c_str ());
+    logStreamState* state = getStreamState (this);
+    return state->mEnabled ? &state->mStream : NULL;
+}
 
-    l.mStream.str ("");
-    l.mStream.clear ();
+void
+logger::endl (logger& l)
+{
+    logStreamState* state = getStreamState (&l);
+    if (!state->mEnabled)
+        return;
 
-    sbfMutex_unlock (&l.mStreamMutex);
+    // a handler streaming to this logger from within handle gets a
+    // state of its own rather than the line being handed out
+    state->mOwner = NULL;
+    l.write (state->mLevel,
+             logClock::now (),
+             state->mBuffer.data (),
+             state->mBuffer.size ());
+    state->mOwner = &l;
+
+    state->mBuffer.reset ();
+    state->mStream.clear ();
 }
 
 logger&
@@ -564,13 +1545,14 @@ logger::debug ()
 logger&
 logger::log (logSeverity::level severity)
 {
-    mStreamLevel = severity;
+    logStreamState* state = getStreamState (this);
+    state->mLevel = severity;
+    state->mEnabled = isLevelEnabled (severity);
     return *this;
 }
 
 logger::~logger()
 {
-    sbfMutex_destroy (&mStreamMutex);
 }
 
 }
@@ -6,15 +6,17 @@
 
 #include "logSeverity.h"
 #include "logHandler.h"
+#include "logLimit.h"
+#include "logAtomic.h"
 #include <properties.h>
 #include <sbfCommon.h>
-#include <sbfMw.h>
-#include <sbfQueue.h>
 
 #include <cstdarg>
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
+#include <ostream>
 #include <sstream>
 
 #ifdef __GNUC__
@@ -28,10 +30,41 @@ namespace neueda
 static const size_t defaultLogMessageChunkSize = 2048;
 
 class logService;
+class logQueue;
+class logStaging;
+class logHandlerSet;
+class logEpoch;
+class logOverflow;
+class logHandlerWorker;
+class logSharedBatch;
+class logRegistry;
+struct logRecord;
+
+// ring pool counters of the spsc staging backend, see
+// logService::getPoolStats; the shared mpsc queue has no pool and reports
+// all zeros
+struct logPoolStats
+{
+    size_t  mAllocated;     // buffers allocated from the heap
+    size_t  mReused;        // times a pooled buffer was handed out again
+    size_t  mInUse;         // buffers owned by a thread or not yet drained
+    size_t  mPooled;        // drained buffers waiting for a new thread
+    size_t  mBufferSize;    // bytes per buffer
+};
+
+// state of a handler's own queue with logger.service.handler.threads, see
+// logService::getHandlerStats
+struct logHandlerStats
+{
+    size_t      mDepth;     // records waiting for the handler
+    uint64_t    mLag;       // nanoseconds the oldest of them has waited
+    uint64_t    mDropped;   // records dropped while its queue was full
+};
 
 class logger
 {
     friend class logService;
+    friend class logRegistry;
 
 public:
     void err (const char* fmt, ...) PRINTF_LIKE(2,3);
@@ -42,15 +75,35 @@ public:
     void fatal (const char* fmt, ...) PRINTF_LIKE(2,3);
     void log (logSeverity::level, const char* fmt, ...) PRINTF_LIKE(3,4);
 
+    // for the rate limited macros, a line following suppressed ones ends
+    // in " (N suppressed)"
+    void logLimited (logSeverity::level,
+                     uint64_t suppressed,
+                     const char* fmt, ...) PRINTF_LIKE(4,5);
+
+    // a rule for this logger's name, so loggers below it without a rule
+    // of their own follow it too, see logService::setLevel
     void setLevel (logSeverity::level lvl);
     logSeverity::level getLevel () const;
 
+    // inline so the LOG_* macros can test it before evaluating arguments.
+    // Also false below the lowest level any handler accepts, nothing
+    // would be written
+    bool isLevelEnabled (logSeverity::level lvl) const
+    {
+        return logAtomic_loadRelaxed (&mThreshold) <= lvl;
+    }
+
     static void endl (logger& l);
 
+    // each thread builds its lines in its own buffer, nothing is
+    // formatted while the level picked by err () .. debug () is disabled
     template<class T>
     logger& operator<< (const T& t)
     {
-        mStream << t;
+        std::ostream* stream = getStream ();
+        if (stream != NULL)
+            *stream << t;
         return *this;
     }
 
@@ -67,24 +120,42 @@ public:
 
     const std::string& getName () const { return mName; }
 
+    // small integer naming this logger in async records
+    uint32_t getId () const { return mId; }
+
 private:
     logger (logger const&);
-    logger (const std::string name, logService* const service, logSeverity::level lvl);
+    logger (const std::string name,
+            logService* const service,
+            logSeverity::level lvl,
+            uint32_t id);
     ~logger ();
 
     void operator= (logger const &);
 
     void vlog (logSeverity::level lvl, const char* fmt, va_list ap);
+    void vlog (logSeverity::level lvl,
+               const char* fmt,
+               va_list ap,
+               uint64_t suppressed);
+    void write (logSeverity::level lvl,
+                uint64_t time,
+                const char* message,
+                size_t messageLen);
     logger& log (logSeverity::level lvl);
 
-    bool isLevelEnabled (logSeverity::level lvl) const;
+    std::ostream* getStream ();
+
+    // recompute mThreshold given the lowest level any handler accepts
+    void refreshThreshold (logSeverity::level handlerLevel);
 
     const std::string   mName;
     logService* const   mService;
-    std::ostringstream  mStream;
-    sbfMutex            mStreamMutex;
-    logSeverity::level  mStreamLevel;
+    const logSeverity::level mDefaultLevel; // when no rule matches
     logSeverity::level  mLevel;
+    logSeverity::level  mThreshold;
+    uint32_t            mGeneration;        // of the rules mLevel came from
+    const uint32_t      mId;
 };
 
 class logService
@@ -96,10 +167,22 @@ public:
 
     static logService& get();
 
+    // safe to call from any thread, see loggerHandle to look a logger up
+    // only once
     static logger* getLogger (const std::string& name);
 
+    // NULL for an unknown id, never locks
+    static logger* getLoggerById (uint32_t id);
+
+    // level of loggers created from now on that no rule matches
     void setLevel (logSeverity::level lvl) { mLevel = lvl; }
 
+    // level of every logger matching pattern: a dotted logger name, which
+    // loggers below it inherit, a name followed by ".*" for everything
+    // below it, or "*". The most specific rule wins. Kept across configure,
+    // which only replaces the logger.level.* rules
+    void setLevel (const std::string& pattern, logSeverity::level lvl);
+
     bool addHandler (logHandler* handler,
                      std::string& errorMessage)
     {
@@ -123,38 +206,380 @@ public:
                  const char* message,
                  size_t messageLen);
 
+    // per-thread staging rings are recycled through a pool, all counters
+    // are zero unless the spsc backend is running
+    void getPoolStats (logPoolStats& stats);
+
+    // records the async queue's overflow policy dropped since it started
+    uint64_t getDropped ();
+
+    // false unless the handler runs on a thread of its own
+    bool getHandlerStats (logHandler* handler, logHandlerStats& stats);
+
+    // lowest level any handler accepts, records below it are rejected by
+    // logger::isLevelEnabled. FATAL with no handlers
+    logSeverity::level getHandlerLevel () const
+    {
+        return logAtomic_loadAcquire (&mHandlerLevel);
+    }
+
+    // called by logHandler::setLevel, a handler already added may have
+    // lowered its level
+    static void handlerLevelChanged ();
+
 private:
     logService ();
     logService (const logService& that);
 
-    bool findLogger (std::string name, logger*& logger);
-
-    bool init (std::string& errorMessage);
+    bool init (logQueue* queue,
+               logStaging* staging,
+               std::string& errorMessage);
 
     void stopDispatching ();
 
+    // publish mHandlers, each behind its own worker with handler threads
+    // handlers configure created and never published, those before
+    // notSetUp are torn down first
+    void deleteHandlers (std::set<logHandler*>& handlers,
+                         std::set<logHandler*>::iterator notSetUp);
+
+    void publishHandlers ();
+
+    void stopWorkers ();
+
+    // recompute mHandlerLevel and push it to every logger
+    void publishLevel ();
+
     static int sbfLogCb (sbfLog log,
                          sbfLogLevel level,
                          const char* message,
                          void* closure);
     static void* dispatchCb (void* closure);
-    static void asyncHandle (sbfQueueItem item, void* closure);
+
+    void asyncHandle (const logRecord* const* records, size_t count);
+
+    // emit a line counting records dropped since the last one, up to the
+    // given total
+    void reportDropped (logOverflow& overflow, uint64_t dropped);
+
+    // hand a batch to a handler's worker, and after it a line counting
+    // what the worker has dropped since the last one
+    void post (logHandlerWorker* worker, logSharedBatch* batch);
+
+    void handle (const logger* source,
+                 logSeverity::level severity,
+                 uint64_t time,
+                 const char* message,
+                 size_t messageLen);
+
+    // false when no queue is taking records, the caller dispatches
+    bool enqueue (const logger* source,
+                  logSeverity::level severity,
+                  uint64_t time,
+                  const char* message,
+                  size_t messageLen);
+
+    void enqueue (logQueue* queue,
+                  const logger* source,
+                  logSeverity::level severity,
+                  uint64_t time,
+                  const char* message,
+                  size_t messageLen);
+
+    bool handleDeferred (const logger* source,
+                         logSeverity::level severity,
+                         uint64_t time,
+                         const char* fmt,
+                         va_list ap);
+
+    void dispatch (logSeverity::level severity,
+                   const char* name,
+                   uint64_t time,
+                   const char* message,
+                   size_t messageLen);
+
+    void dispatchBatch ();
 
     sbfMutex                        mMutex;
     sbfLog                          mSbfLog;
-    sbfMw                           mMw;
-    sbfQueue                        mQueue;
+    logQueue*                       mQueue;
+    logStaging*                     mStaging;
     sbfThread                       mThread;
     bool                            mDispatching;
+    bool                            mAccepting;     // producers may enqueue
+    logEpoch*                       mProducers;     // guards mQueue, mStaging
     bool                            mIsAsync;
+    bool                            mIsDeferred;
     logSeverity::level              mLevel;
-    std::map<std::string, logger*>  mloggers;
+    logSeverity::level              mHandlerLevel;
+    logRegistry*                    mRegistry;
     std::set<logHandler*>           mHandlers;
+    logHandlerSet*                  mHandlerSet;
+    bool                            mHandlerThreads;
+    size_t                          mHandlerQueueCapacity;
+    int                             mHandlerQueueOverflow;  // logOverflow::policy
+    std::map<logHandler*, logHandlerWorker*> mWorkers;
     std::map<logHandler*, bool>     mHandlerOwnedTable;
+    std::vector<logBatchEntry>      mBatch;
+    std::vector<size_t>             mBatchOffsets;
+    std::string                     mDeferredBuffer;
 
     static logService*              mInstance;
 };
 
+/*
+ * A logger looked up by name on first use and cached after that, meant
+ * to be kept as a static so a call site pays for the lookup only once:
+ *
+ *     static loggerHandle log ("net.session");
+ *     log->info ("connected to %s", host);
+ */
+class loggerHandle
+{
+public:
+    explicit loggerHandle (const char* name) : mName (name), mLogger (NULL) { }
+
+    logger* get ()
+    {
+        logger* l = logAtomic_loadAcquire (&mLogger);
+        if (l == NULL)
+        {
+            // racing threads get the same logger back
+            l = logService::getLogger (mName);
+            logAtomic_storeRelease (&mLogger, l);
+        }
+        return l;
+    }
+
+    logger* operator-> () { return get (); }
+
+private:
+    const char* mName;
+    logger*     mLogger;
+};
+
 };
 
+/*
+ * Logging macros that test the logger's level inline, so when it is off
+ * none of the arguments are evaluated and no call is made:
+ *
+ *     LOG_DEBUG (log, "order %d filled at %f", id, price);
+ *     LOG_DEBUG_STREAM (log) << "order " << id << logger::endl;
+ *
+ * Defining LOGGER_MIN_LEVEL, e.g. -DLOGGER_MIN_LEVEL=LOGGER_LEVEL_INFO,
+ * removes every call below that level at compile time. Removed calls are
+ * still type checked.
+ */
+#define LOGGER_LEVEL_TRACE  0
+#define LOGGER_LEVEL_DEBUG  1
+#define LOGGER_LEVEL_INFO   2
+#define LOGGER_LEVEL_WARN   3
+#define LOGGER_LEVEL_ERROR  4
+#define LOGGER_LEVEL_FATAL  5
+
+#ifndef LOGGER_MIN_LEVEL
+# define LOGGER_MIN_LEVEL LOGGER_LEVEL_TRACE
+#endif
+
+#define LOGGER_CALL_(_logger, _level, _method, ...)                     \
+    do {                                                                \
+        neueda::logger* const _l = (_logger);                           \
+        if (_l->isLevelEnabled (neueda::logSeverity::_level))           \
+            _l->_method (__VA_ARGS__);                                  \
+    } while (0)
+
+#define LOGGER_ELIDED_(_logger, _method, ...)                           \
+    do {                                                                \
+        if (0)                                                          \
+            (_logger)->_method (__VA_ARGS__);                           \
+    } while (0)
+
+// the dangling else keeps the macro safe inside an unbraced if
+#define LOGGER_STREAM_(_logger, _level, _method)                        \
+    if (!(_logger)->isLevelEnabled (neueda::logSeverity::_level))       \
+        ;                                                               \
+    else                                                                \
+        (_logger)->_method ()
+
+#define LOGGER_STREAM_ELIDED_(_logger, _method)                         \
+    if (1)                                                              \
+        ;                                                               \
+    else                                                                \
+        (_logger)->_method ()
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_TRACE
+# define LOG_TRACE(_logger, ...) \
+    LOGGER_CALL_ (_logger, TRACE, trace, __VA_ARGS__)
+# define LOG_TRACE_STREAM(_logger) LOGGER_STREAM_ (_logger, TRACE, trace)
+#else
+# define LOG_TRACE(_logger, ...) LOGGER_ELIDED_ (_logger, trace, __VA_ARGS__)
+# define LOG_TRACE_STREAM(_logger) LOGGER_STREAM_ELIDED_ (_logger, trace)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_DEBUG
+# define LOG_DEBUG(_logger, ...) \
+    LOGGER_CALL_ (_logger, DEBUG, debug, __VA_ARGS__)
+# define LOG_DEBUG_STREAM(_logger) LOGGER_STREAM_ (_logger, DEBUG, debug)
+#else
+# define LOG_DEBUG(_logger, ...) LOGGER_ELIDED_ (_logger, debug, __VA_ARGS__)
+# define LOG_DEBUG_STREAM(_logger) LOGGER_STREAM_ELIDED_ (_logger, debug)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_INFO
+# define LOG_INFO(_logger, ...) \
+    LOGGER_CALL_ (_logger, INFO, info, __VA_ARGS__)
+# define LOG_INFO_STREAM(_logger) LOGGER_STREAM_ (_logger, INFO, info)
+#else
+# define LOG_INFO(_logger, ...) LOGGER_ELIDED_ (_logger, info, __VA_ARGS__)
+# define LOG_INFO_STREAM(_logger) LOGGER_STREAM_ELIDED_ (_logger, info)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_WARN
+# define LOG_WARN(_logger, ...) \
+    LOGGER_CALL_ (_logger, WARN, warn, __VA_ARGS__)
+# define LOG_WARN_STREAM(_logger) LOGGER_STREAM_ (_logger, WARN, warn)
+#else
+# define LOG_WARN(_logger, ...) LOGGER_ELIDED_ (_logger, warn, __VA_ARGS__)
+# define LOG_WARN_STREAM(_logger) LOGGER_STREAM_ELIDED_ (_logger, warn)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_ERROR
+# define LOG_ERROR(_logger, ...) \
+    LOGGER_CALL_ (_logger, ERROR, err, __VA_ARGS__)
+# define LOG_ERROR_STREAM(_logger) LOGGER_STREAM_ (_logger, ERROR, err)
+#else
+# define LOG_ERROR(_logger, ...) LOGGER_ELIDED_ (_logger, err, __VA_ARGS__)
+# define LOG_ERROR_STREAM(_logger) LOGGER_STREAM_ELIDED_ (_logger, err)
+#endif
+
+// fatal exits the process, it is never compiled out
+#define LOG_FATAL(_logger, ...) \
+    LOGGER_CALL_ (_logger, FATAL, fatal, __VA_ARGS__)
+
+/*
+ * Rate limited variants, each call site keeps its own state in a static,
+ * see logLimit.h. The next line let through after some were turned away
+ * ends in " (N suppressed)":
+ *
+ *     LOG_WARN_EVERY_N (log, 1000, "gap in feed %s", feed);
+ *     LOG_WARN_FIRST_N (log, 10, 1000, "gap in feed %s", feed);
+ *     LOG_WARN_RATE (log, 5, 20, "gap in feed %s", feed);
+ *
+ * EVERY_N logs one record in every n, FIRST_N the first n then one in
+ * every m after that, and RATE a token bucket of rate records a second
+ * with bursts of up to burst. Records below the logger's level are not
+ * counted.
+ */
+#define LOGGER_SAMPLED_(_logger, _level, _first, _every, ...)           \
+    do {                                                                \
+        neueda::logger* const _l = (_logger);                           \
+        static neueda::logSampler _site = { (_first), (_every), 0, 0 }; \
+        uint64_t _suppressed;                                           \
+        if (_l->isLevelEnabled (neueda::logSeverity::_level)            \
+            && _site.admit (_suppressed))                               \
+            _l->logLimited (neueda::logSeverity::_level,                \
+                            _suppressed,                                \
+                            __VA_ARGS__);                               \
+    } while (0)
+
+#define LOGGER_RATE_(_logger, _level, _rate, _burst, ...)               \
+    do {                                                                \
+        neueda::logger* const _l = (_logger);                           \
+        static neueda::logRateLimit _site = { (_rate), (_burst), 0, 0 };\
+        uint64_t _suppressed;                                           \
+        if (_l->isLevelEnabled (neueda::logSeverity::_level)            \
+            && _site.admit (_suppressed))                               \
+            _l->logLimited (neueda::logSeverity::_level,                \
+                            _suppressed,                                \
+                            __VA_ARGS__);                               \
+    } while (0)
+
+#define LOGGER_LIMITED_ELIDED_(_logger, _level, ...)                    \
+    LOGGER_ELIDED_ (_logger,                                            \
+                    logLimited,                                         \
+                    neueda::logSeverity::_level,                        \
+                    0,                                                  \
+                    __VA_ARGS__)
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_TRACE
+# define LOG_TRACE_EVERY_N(_logger, _n, ...) \
+    LOGGER_SAMPLED_ (_logger, TRACE, 1, _n, __VA_ARGS__)
+# define LOG_TRACE_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_SAMPLED_ (_logger, TRACE, _n, _m, __VA_ARGS__)
+# define LOG_TRACE_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_RATE_ (_logger, TRACE, _rate, _burst, __VA_ARGS__)
+#else
+# define LOG_TRACE_EVERY_N(_logger, _n, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, TRACE, __VA_ARGS__)
+# define LOG_TRACE_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, TRACE, __VA_ARGS__)
+# define LOG_TRACE_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, TRACE, __VA_ARGS__)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_DEBUG
+# define LOG_DEBUG_EVERY_N(_logger, _n, ...) \
+    LOGGER_SAMPLED_ (_logger, DEBUG, 1, _n, __VA_ARGS__)
+# define LOG_DEBUG_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_SAMPLED_ (_logger, DEBUG, _n, _m, __VA_ARGS__)
+# define LOG_DEBUG_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_RATE_ (_logger, DEBUG, _rate, _burst, __VA_ARGS__)
+#else
+# define LOG_DEBUG_EVERY_N(_logger, _n, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, DEBUG, __VA_ARGS__)
+# define LOG_DEBUG_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, DEBUG, __VA_ARGS__)
+# define LOG_DEBUG_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, DEBUG, __VA_ARGS__)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_INFO
+# define LOG_INFO_EVERY_N(_logger, _n, ...) \
+    LOGGER_SAMPLED_ (_logger, INFO, 1, _n, __VA_ARGS__)
+# define LOG_INFO_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_SAMPLED_ (_logger, INFO, _n, _m, __VA_ARGS__)
+# define LOG_INFO_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_RATE_ (_logger, INFO, _rate, _burst, __VA_ARGS__)
+#else
+# define LOG_INFO_EVERY_N(_logger, _n, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, INFO, __VA_ARGS__)
+# define LOG_INFO_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, INFO, __VA_ARGS__)
+# define LOG_INFO_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, INFO, __VA_ARGS__)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_WARN
+# define LOG_WARN_EVERY_N(_logger, _n, ...) \
+    LOGGER_SAMPLED_ (_logger, WARN, 1, _n, __VA_ARGS__)
+# define LOG_WARN_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_SAMPLED_ (_logger, WARN, _n, _m, __VA_ARGS__)
+# define LOG_WARN_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_RATE_ (_logger, WARN, _rate, _burst, __VA_ARGS__)
+#else
+# define LOG_WARN_EVERY_N(_logger, _n, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, WARN, __VA_ARGS__)
+# define LOG_WARN_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, WARN, __VA_ARGS__)
+# define LOG_WARN_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, WARN, __VA_ARGS__)
+#endif
+
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_ERROR
+# define LOG_ERROR_EVERY_N(_logger, _n, ...) \
+    LOGGER_SAMPLED_ (_logger, ERROR, 1, _n, __VA_ARGS__)
+# define LOG_ERROR_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_SAMPLED_ (_logger, ERROR, _n, _m, __VA_ARGS__)
+# define LOG_ERROR_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_RATE_ (_logger, ERROR, _rate, _burst, __VA_ARGS__)
+#else
+# define LOG_ERROR_EVERY_N(_logger, _n, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, ERROR, __VA_ARGS__)
+# define LOG_ERROR_FIRST_N(_logger, _n, _m, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, ERROR, __VA_ARGS__)
+# define LOG_ERROR_RATE(_logger, _rate, _burst, ...) \
+    LOGGER_LIMITED_ELIDED_ (_logger, ERROR, __VA_ARGS__)
+#endif
+
 #undef PRINTF_LIKE
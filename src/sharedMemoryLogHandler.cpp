@@ -64,25 +64,7 @@ sharedMemoryLogHandler::handle (logSeverity::level severity,
     sbfMutex_lock (&mMutex);
 
     if (isReady ())
-    {
-        struct logEntry entry;
-        memset (&entry, 0, sizeof entry);
-	
-        entry.severity = severity;
-	entry.mTime = time;
-
-        size_t nameCopySize = (strlen(name) > sizeof (entry.mName))
-            ? sizeof (entry.mName)
-            : strlen(name);
-        strncpy (entry.mName, name, nameCopySize);
-
-        size_t msgCopySize = (message_len > sizeof (entry.mMessage))
-            ? sizeof (entry.mMessage)
-            : message_len;
-        strncpy (entry.mMessage, message, msgCopySize);
-
-        mBuffer->blockingEnqueue (&entry);
-    }
+        mBuffer->blockingEnqueue (name, severity, time, message, message_len);
 
     sbfMutex_unlock (&mMutex);
 }
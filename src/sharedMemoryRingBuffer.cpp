@@ -3,6 +3,7 @@
  */
 
 #include "sharedMemoryRingBuffer.h"
+#include "logRegistry.h"
 
 #include <cerrno>
 #include <cstdlib>
@@ -11,7 +12,12 @@
 #include <sys/types.h>
 #include <sys/shm.h>
 
-static const unsigned int kDefaultMaxRingBufferLength = 512;
+// bytes of record space in the shared region
+static const size_t kDefaultRingBufferSize = 1024 * 1024;
+
+// the records start on a cache line after the header
+static const size_t kRingBufferOffset =
+    (sizeof (neueda::shmLogEntryHeader) + 63) & ~(size_t)63;
 
 namespace neueda
 {
@@ -20,15 +26,13 @@ sharedMemoryRingBuffer::sharedMemoryRingBuffer (int shmid,
                                                 uint8_t* handle,
                                                 bool owned,
                                                 key_t key,
-                                                size_t elementSize,
-                                                size_t length,
+                                                size_t size,
                                                 size_t offset) :
     mShmid (shmid),
     mHandle (handle),
     mOwned (owned),
     mKey (key),
-    mElementSize (elementSize),
-    mLength (length),
+    mSize (size),
     mOffset (offset),
     mDidSignal (false)
 {
@@ -46,8 +50,7 @@ sharedMemoryRingBuffer*
 sharedMemoryRingBuffer::create (key_t key, string& error)
 {
     int shmFlags = 0644 | IPC_CREAT | IPC_EXCL;
-    size_t size = sizeof (struct shmLogEntryHeader)
-        + (kDefaultMaxRingBufferLength * sizeof (struct logEntry));
+    size_t size = kRingBufferOffset + kDefaultRingBufferSize;
 
     int shmid = shmget (key, size, shmFlags);
     if (shmid == -1)
@@ -77,39 +80,26 @@ sharedMemoryRingBuffer::create (key_t key, string& error)
     sbfCondAttr_init (&condAttr);
     sbfCondAttr_setpshared (&condAttr, PTHREAD_PROCESS_SHARED);
     sbfCondVar_init_attr (&(handleEntry->mCond), &condAttr);
-
-    // init sema
-    int pshared = 1;
-    bool ok = sem_init (&(handleEntry->mSema),
-                        pshared,
-                        kDefaultMaxRingBufferLength) == 0;
-    if (!ok)
-    {
-        string e (strerror (errno));
-        error.assign ("failed to init semaphore: " + e);
-        return NULL;
-    }
+    sbfCondVar_init_attr (&(handleEntry->mSpace), &condAttr);
 
     // init state
     handleEntry->mHead = 0;
     handleEntry->mTail = 0;
-    handleEntry->mSize = 0;
+    handleEntry->mSize = kDefaultRingBufferSize;
 
     return new sharedMemoryRingBuffer (shmid,
                                        handle,
                                        true,
                                        key,
-                                       sizeof (struct logEntry),
-                                       kDefaultMaxRingBufferLength,
-                                       offsetof (struct shmLogEntryHeader, mEntries));
+                                       kDefaultRingBufferSize,
+                                       kRingBufferOffset);
 }
 
 sharedMemoryRingBuffer*
 sharedMemoryRingBuffer::attach (key_t key, string& error)
 {
     int shmFlags = 0644;
-    size_t size = sizeof (struct shmLogEntryHeader)
-        + (kDefaultMaxRingBufferLength * sizeof (struct logEntry));
+    size_t size = kRingBufferOffset + kDefaultRingBufferSize;
 
     int shmid = shmget (key, size, shmFlags);
     if (shmid == -1)
@@ -130,9 +120,8 @@ sharedMemoryRingBuffer::attach (key_t key, string& error)
                                        handle,
                                        false,
                                        key,
-                                       sizeof (struct logEntry),
-                                       kDefaultMaxRingBufferLength,
-                                       offsetof (struct shmLogEntryHeader, mEntries));
+                                       kDefaultRingBufferSize,
+                                       kRingBufferOffset);
 }
 
 void
@@ -147,76 +136,101 @@ sharedMemoryRingBuffer::clearSharedMemory ()
     shmctl (mShmid, IPC_RMID, NULL);
 }
 
-void
-sharedMemoryRingBuffer::blockingEnqueue (const logEntry* entry)
-{
-    sem_wait (&(getHeader ()->mSema));
-    sbfMutex_lock (&(getHeader ()->mMutex)); // lock table
-
-    insertElement (entry);
-
-    sbfCondVar_signal (&(getHeader ()->mCond));
-    sbfMutex_unlock (&(getHeader ()->mMutex));
-}
-
-bool
-sharedMemoryRingBuffer::blockingDequeue (logEntry* entry)
+size_t
+sharedMemoryRingBuffer::maxMessageSize (size_t nameLen) const
 {
-    sbfMutex_lock (&(getHeader ()->mMutex)); // lock table
-    while (getSize () == 0 and !mDidSignal)
-        sbfCondVar_wait (&(getHeader ()->mCond), &(getHeader ()->mMutex));
-
-    bool ok = takeElement (entry);
-    if (ok)
-        sem_post (&(getHeader ()->mSema)); // release resource
-
-    sbfMutex_unlock (&(getHeader ()->mMutex));
-
-    return ok;
+    // a record may use up to a quarter of the ring
+    return mSize / 4 - logRecord::sizeFor (nameLen, 0);
 }
 
 void
-sharedMemoryRingBuffer::insertElement (const logEntry* entry)
+sharedMemoryRingBuffer::blockingEnqueue (const char* name,
+                                         logSeverity::level severity,
+                                         uint64_t time,
+                                         const char* message,
+                                         size_t messageLen)
 {
-    struct shmLogEntryHeader* hdr = getHeader ();
+    size_t nameLen = strlen (name);
+    if (nameLen > logRecord::kMaxNameLength)
+        nameLen = logRecord::kMaxNameLength;
+    if (messageLen > maxMessageSize (nameLen))
+        messageLen = maxMessageSize (nameLen);
+    size_t length = logRecord::sizeFor (nameLen, messageLen);
 
-    size_t offs = hdr->mHead * mElementSize;
-    uint8_t* table = getEntriesTable ();
+    struct shmLogEntryHeader* hdr = getHeader ();
+    sbfMutex_lock (&(hdr->mMutex)); // lock table
 
-    memcpy (table + offs, entry, sizeof (struct logEntry));
-    hdr->mSize += 1;
+    // a record never straddles the end of the ring, the remainder is
+    // filled with a pad instead
+    size_t pad;
+    for (;;)
+    {
+        size_t offs = hdr->mHead % mSize;
+        pad = (offs + length > mSize) ? mSize - offs : 0;
+        if (hdr->mHead + pad + length - hdr->mTail <= mSize)
+            break;
+        sbfCondVar_wait (&(hdr->mSpace), &(hdr->mMutex));
+    }
 
-    // update indexes
-    hdr->mHead += 1;
-    if (hdr->mHead == mLength)
+    if (pad > 0)
     {
-        hdr->mHead = 0;
+        logRecord::pad ((char*)recordAt (hdr->mHead), pad);
+        hdr->mHead += pad;
     }
+
+    logRecord* record = recordAt (hdr->mHead);
+    char* body = record->init (logRegistry::kNoId, name, nameLen, severity, time);
+    memcpy (body, message, messageLen);
+    record->mLength = record->finish (messageLen);
+    hdr->mHead += length;
+
+    sbfCondVar_signal (&(hdr->mCond));
+    sbfMutex_unlock (&(hdr->mMutex));
 }
 
-// assumes caller has acquired locks correctly
 bool
-sharedMemoryRingBuffer::takeElement (logEntry* entry)
+sharedMemoryRingBuffer::blockingDequeue (std::vector<char>& buffer)
 {
     struct shmLogEntryHeader* hdr = getHeader ();
-    if (hdr->mSize == 0)
+    sbfMutex_lock (&(hdr->mMutex)); // lock table
+
+    const logRecord* record = NULL;
+    for (;;)
     {
-        return false;
+        // skip pads left at the end of the ring
+        while (hdr->mHead != hdr->mTail)
+        {
+            record = recordAt (hdr->mTail);
+            if (!(record->mFlags & logRecord::RECORD_PAD))
+                break;
+            hdr->mTail += record->mLength;
+            record = NULL;
+        }
+
+        if (record != NULL || mDidSignal)
+            break;
+        sbfCondVar_wait (&(hdr->mCond), &(hdr->mMutex));
     }
 
-    size_t offs = hdr->mTail * mElementSize;
-    uint8_t* table = getEntriesTable ();
-
-    memcpy (entry, table + offs, sizeof (struct logEntry));
-    hdr->mSize -= 1;
-
-    hdr->mTail += 1;
-    if (hdr->mTail == mLength)
+    bool ok = record != NULL;
+    if (ok)
     {
-        hdr->mTail = 0;
+        buffer.assign ((const char*)record, (const char*)record + record->mLength);
+        hdr->mTail += record->mLength;
+
+        // producers may be waiting on records of different sizes
+        sbfCondVar_broadcast (&(hdr->mSpace)); // release resource
     }
 
-    return true;
+    sbfMutex_unlock (&(hdr->mMutex));
+
+    return ok;
+}
+
+logRecord*
+sharedMemoryRingBuffer::recordAt (uint64_t position)
+{
+    return (logRecord*)(getEntriesTable () + position % mSize);
 }
 
 shmLogEntryHeader*
@@ -231,12 +245,6 @@ sharedMemoryRingBuffer::getEntriesTable ()
     return mHandle + mOffset;
 }
 
-size_t
-sharedMemoryRingBuffer::getSize ()
-{
-    return getHeader ()->mSize;
-}
-
 void
 sharedMemoryRingBuffer::signal ()
 {
@@ -5,35 +5,33 @@
 #pragma once
 
 #include "logger.h"
+#include "logRecord.h"
 #include "logSeverity.h"
 #include "sbfCommon.h"
 
 #include <string>
 #include <cstring>
-#include <semaphore.h>
+#include <vector>
 
 using namespace std;
 
 namespace neueda
 {
 
-struct logEntry
-{
-    logSeverity::level      severity;
-    char                    mName[64];
-    uint64_t                mTime;
-    char                    mMessage[defaultLogMessageChunkSize];
-};
-
+/*
+ * The shared region is this header followed by a byte ring of logRecords,
+ * the same layout the in-process queues use, so a message of any length up
+ * to a quarter of the ring travels as one record. Positions only grow, the
+ * ring offset is position % size.
+ */
 struct shmLogEntryHeader
 {
     sbfMutex            mMutex;
-    sbfCondVar          mCond;
-    sem_t               mSema;
-    size_t              mHead;
-    size_t              mTail;
-    size_t              mSize;
-    struct logEntry*    mEntries;
+    sbfCondVar          mCond;      // a record was added
+    sbfCondVar          mSpace;     // a record was removed
+    uint64_t            mHead;
+    uint64_t            mTail;
+    uint64_t            mSize;
 };
 
 class sharedMemoryRingBuffer
@@ -43,9 +41,17 @@ public:
 
     static sharedMemoryRingBuffer* attach (key_t key, string& error);
 
-    void blockingEnqueue (const struct logEntry* entry);
+    // messages longer than maxMessageSize () are truncated
+    void blockingEnqueue (const char* name,
+                          logSeverity::level severity,
+                          uint64_t time,
+                          const char* message,
+                          size_t messageLen);
+
+    // copies the next record into buffer, which then holds a logRecord
+    bool blockingDequeue (std::vector<char>& buffer);
 
-    bool blockingDequeue (struct logEntry* entry);
+    size_t maxMessageSize (size_t nameLen) const;
 
     ~sharedMemoryRingBuffer ();
 
@@ -56,30 +62,24 @@ private:
                             uint8_t* handle,
                             bool mOwned,
                             key_t key,
-                            size_t elementSize,
-                            size_t length,
+                            size_t size,
                             size_t offset);
 
     void detach ();
 
     void clearSharedMemory ();
 
-    void insertElement (const struct logEntry* entry);
-
-    bool takeElement (struct logEntry* entry);
+    logRecord* recordAt (uint64_t position);
 
     shmLogEntryHeader* getHeader ();
 
     uint8_t* getEntriesTable ();
 
-    size_t getSize ();
-
     int             mShmid;
     uint8_t*        mHandle;
     bool            mOwned;
     key_t           mKey;
-    size_t          mElementSize;
-    size_t          mLength;
+    size_t          mSize;
     size_t          mOffset;
     bool            mDidSignal;
 };
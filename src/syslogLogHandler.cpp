@@ -11,6 +11,12 @@ namespace neueda
 syslogLogHandler::syslogLogHandler ()
     : logHandler ()
 {
+    sbfMutex_init (&mMutex, 0);
+}
+
+syslogLogHandler::~syslogLogHandler ()
+{
+    sbfMutex_destroy (&mMutex);
 }
 
 void
@@ -20,15 +26,52 @@ syslogLogHandler::handle (logSeverity::level severity,
                           const char* message,
                           size_t message_len)
 {
-    string logString = toString (mFormat,
-                                 severity,
-                                 name,
-                                 time,
-                                 message,
-                                 message_len);
+    sbfMutex_lock (&mMutex);
+    write (severity, name, time, message, message_len);
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+syslogLogHandler::handleBatch (const logBatchEntry* entries, size_t count)
+{
+    // syslog has no call taking several records and joining them would
+    // merge them into one entry, so this only saves the per record
+    // virtual dispatch and locking
+    sbfMutex_lock (&mMutex);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const logBatchEntry& entry = entries[i];
+        if (!isLevelEnabled (entry.mSeverity))
+            continue;
+
+        write (entry.mSeverity,
+               entry.mName,
+               entry.mTime,
+               entry.mMessage,
+               entry.mMessageLen);
+    }
+
+    sbfMutex_unlock (&mMutex);
+}
+
+void
+syslogLogHandler::write (logSeverity::level severity,
+                         const char* name,
+                         uint64_t time,
+                         const char* message,
+                         size_t message_len)
+{
+    mLine.clear ();
+    mFormatter.render (mLine,
+                       severity,
+                       name,
+                       time,
+                       message,
+                       message_len);
     syslog (severityToSyslogPriority (severity),
             "%s",
-            logString.c_str ());
+            mLine.c_str ());
 }
 
 int
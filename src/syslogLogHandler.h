@@ -15,7 +15,9 @@ class syslogLogHandler: public logHandler
 {
 public:
     syslogLogHandler ();
-    
+
+    ~syslogLogHandler ();
+
     void teardown () { }
 
     void handle (logSeverity::level severity,
@@ -24,7 +26,19 @@ public:
                  const char* message,
                  size_t message_len);
 
+    void handleBatch (const logBatchEntry* entries, size_t count);
+
     static int severityToSyslogPriority (logSeverity::level level);
+
+private:
+    void write (logSeverity::level severity,
+                const char* name,
+                uint64_t time,
+                const char* message,
+                size_t message_len);
+
+    string      mLine;
+    sbfMutex    mMutex;
 };
 
 };
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/time.h>
+
+using namespace neueda;
+using namespace std;
+
+// count calls into operator new while a measurement is running. This
+// replaces it for the whole binary, which is why this is a benchmark of
+// its own rather than part of unittest
+static volatile bool gCountAllocations = false;
+static volatile size_t gAllocations = 0;
+
+void*
+operator new (size_t size)
+{
+    if (gCountAllocations)
+        __sync_fetch_and_add (&gAllocations, 1);
+
+    void* p = malloc (size == 0 ? 1 : size);
+    if (p == NULL)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void
+operator delete (void* p) throw ()
+{
+    free (p);
+}
+
+void*
+operator new[] (size_t size)
+{
+    return operator new (size);
+}
+
+void
+operator delete[] (void* p) throw ()
+{
+    free (p);
+}
+
+class countingLogHandler : public logHandler
+{
+public:
+    countingLogHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mCount++;
+    }
+
+    size_t mCount;
+};
+
+class vlogBenchmarkHarness : public ::testing::Test
+{
+protected:
+    virtual void SetUp ()
+    {
+        mLogger = logService::getLogger ("TEST_VLOG_BENCHMARK");
+        mLogger->setLevel (logSeverity::TRACE);
+
+        mHandler = new countingLogHandler ();
+        mHandler->setLevel (logSeverity::TRACE);
+
+        string errorMessage;
+        ASSERT_TRUE (logService::get ().addHandler (mHandler,
+                                                    errorMessage,
+                                                    true));
+    }
+
+    virtual void TearDown ()
+    {
+        logService::get ().removeHandler (mHandler);
+    }
+
+    logger*             mLogger;
+    countingLogHandler* mHandler;
+};
+
+TEST_F(vlogBenchmarkHarness, TEST_VLOG_DOES_NOT_ALLOCATE_UNDER_CHUNK_SIZE)
+{
+    const size_t iterations = 200000;
+
+    // warm up the thread local scratch buffer
+    mLogger->trace ("warm up %d", 0);
+
+    timeval start;
+    timeval end;
+
+    gAllocations = 0;
+    gCountAllocations = true;
+    gettimeofday (&start, NULL);
+
+    for (size_t i = 0; i < iterations; i++)
+        mLogger->trace ("order %zu filled %d@%f on %s", i, 100, 99.5, "VOD.L");
+
+    gettimeofday (&end, NULL);
+    gCountAllocations = false;
+
+    double elapsedNs = ((end.tv_sec - start.tv_sec) * 1e9)
+        + ((end.tv_usec - start.tv_usec) * 1e3);
+    printf ("vlog: %zu messages, %.1f ns/message, %zu allocations\n",
+            iterations,
+            elapsedNs / iterations,
+            (size_t)gAllocations);
+
+    ASSERT_EQ (mHandler->mCount, iterations + 1);
+    ASSERT_EQ ((size_t)gAllocations, 0u);
+}
@@ -6,6 +6,9 @@
 #include <gtest/gtest.h>
 
 #include "logger.h"
+#include "properties.h"
+
+#include <unistd.h>
 
 
 using namespace neueda;
@@ -59,12 +62,14 @@ TEST_F(LoggerHandlerTestHarness, TEST_EXCEED_BUFFER_SIZE)
     bool ok = service.addHandler (handler, errorMessage, true);
     ASSERT_TRUE (ok);
 
+    // longer than a chunk, still delivered as a single record
     EXPECT_CALL (*handler, handle (::testing::_,
                                    ::testing::_,
                                    ::testing::_,
                                    ::testing::_,
-                                   ::testing::_))
-        .Times (2);
+                                   defaultLogMessageChunkSize
+                                   + (defaultLogMessageChunkSize / 2)))
+        .Times (1);
 
     mLogger->info ("%s", testBuffer);
     EXPECT_CALL (*handler, teardown ()).Times (1);
@@ -72,3 +77,55 @@ TEST_F(LoggerHandlerTestHarness, TEST_EXCEED_BUFFER_SIZE)
 
     delete [] testBuffer;
 }
+
+class recordingLogHandler : public logHandler
+{
+public:
+    recordingLogHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mMessage.assign (message, message_len);
+        __sync_fetch_and_add (&mCount, 1);
+    }
+
+    string          mMessage;
+    volatile int    mCount;
+};
+
+TEST_F(LoggerHandlerTestHarness, TEST_EXCEED_BUFFER_SIZE_ASYNC)
+{
+    string longMessage (defaultLogMessageChunkSize * 5, '2');
+
+    logService& service = logService::get ();
+
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+
+    string errorMessage;
+    ASSERT_TRUE (service.configure (p, errorMessage));
+
+    recordingLogHandler* handler = new recordingLogHandler ();
+    ASSERT_TRUE (service.addHandler (handler, errorMessage, false));
+
+    mLogger->info ("%s", longMessage.c_str ());
+
+    for (int i = 0; i < 1000 && handler->mCount < 1; i++)
+        usleep (1000);
+
+    // the queue carries the whole line as one record
+    ASSERT_EQ (handler->mCount, 1);
+    ASSERT_EQ (handler->mMessage, longMessage);
+
+    service.removeHandler (handler);
+    delete handler;
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (service.configure (sync, errorMessage));
+}
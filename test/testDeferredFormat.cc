@@ -0,0 +1,141 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logger.h"
+#include "logArgs.h"
+#include "properties.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace neueda;
+using namespace std;
+
+static bool
+roundTrip (string& out, const char* fmt, ...)
+{
+    char buffer[defaultLogMessageChunkSize];
+    size_t length = 0;
+
+    va_list ap;
+    va_start (ap, fmt);
+    bool ok = logArgs::encode (fmt, ap, buffer, sizeof buffer, length);
+    va_end (ap);
+
+    if (ok)
+        logArgs::render (out, fmt, buffer, length);
+    return ok;
+}
+
+class capturingLogHandler : public logHandler
+{
+public:
+    capturingLogHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mLast.assign (message, message_len);
+        __sync_fetch_and_add (&mCount, 1);
+    }
+
+    string          mLast;
+    volatile int    mCount;
+};
+
+TEST(deferredFormatTest, TEST_RENDER_MATCHES_SNPRINTF)
+{
+    char local[] = "by value";
+    char expected[256];
+    snprintf (expected,
+              sizeof expected,
+              "%d|%5s|%-4u|%c|%%|%*d|%.*f|%lu|%lld|%zu|%x|%e|%s",
+              -42, "ab", 7u, 'z', 6, 9, 3, 3.14159, 123456789ul,
+              -5ll, (size_t)99, 255u, 1.5e10, local);
+
+    string out;
+    ASSERT_TRUE (roundTrip (out,
+                            "%d|%5s|%-4u|%c|%%|%*d|%.*f|%lu|%lld|%zu|%x|%e|%s",
+                            -42, "ab", 7u, 'z', 6, 9, 3, 3.14159, 123456789ul,
+                            -5ll, (size_t)99, 255u, 1.5e10, local));
+    ASSERT_STREQ (out.c_str (), expected);
+}
+
+TEST(deferredFormatTest, TEST_ENCODE_STOPS_AT_STRING_PRECISION)
+{
+    // four bytes, not terminated, right before a page that faults
+    size_t page = sysconf (_SC_PAGESIZE);
+    char* map = static_cast<char*>(mmap (NULL,
+                                         2 * page,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS,
+                                         -1,
+                                         0));
+    ASSERT_TRUE (map != MAP_FAILED);
+    ASSERT_EQ (mprotect (map + page, page, PROT_NONE), 0);
+
+    char* s = map + page - 4;
+    memcpy (s, "ABCD", 4);
+
+    string out;
+    ASSERT_TRUE (roundTrip (out, "%.*s|%.3s|%*.*s|%.9s", 4, s, s, 6, 2, s, "ab"));
+    ASSERT_EQ (out, "ABCD|ABC|    AB|ab");
+
+    munmap (map, 2 * page);
+}
+
+TEST(deferredFormatTest, TEST_ENCODE_REJECTS_UNREPLAYABLE_CONVERSIONS)
+{
+    string out;
+    int n = 0;
+    ASSERT_FALSE (roundTrip (out, "abc%n", &n));
+    ASSERT_FALSE (roundTrip (out, "%1$d", 1));
+    ASSERT_FALSE (roundTrip (out, "%ls", L"wide"));
+}
+
+TEST(deferredFormatTest, TEST_DEFERRED_SERVICE_RENDERS_ON_DISPATCH_THREAD)
+{
+    logService& service = logService::get ();
+
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+    p.setProperty ("logger.service.deferred", "true");
+
+    string err;
+    ASSERT_TRUE (service.configure (p, err));
+
+    capturingLogHandler* handler = new capturingLogHandler ();
+    ASSERT_TRUE (service.addHandler (handler, err, false));
+
+    logger* log = logService::getLogger ("TEST_DEFERRED");
+    {
+        // the string argument is copied, not referenced
+        char temporary[32];
+        snprintf (temporary, sizeof temporary, "%s", "order");
+        log->info ("%s %d filled at %.2f", temporary, 17, 101.25);
+        memset (temporary, 0, sizeof temporary);
+    }
+
+    for (int i = 0; i < 1000 && handler->mCount == 0; i++)
+        usleep (1000);
+
+    ASSERT_EQ (handler->mCount, 1);
+    ASSERT_STREQ (handler->mLast.c_str (), "order 17 filled at 101.25");
+
+    service.removeHandler (handler);
+    delete handler;
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (service.configure (sync, err));
+}
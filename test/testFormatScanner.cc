@@ -19,20 +19,20 @@ protected:
         time_t t = mTv.tv_sec;
         gmtime_r (&t, &mTimee);
 
-        mTime = 1000000 * mTv.tv_sec + mTv.tv_usec;
+        mTime = 1000000000ULL * mTv.tv_sec + mTv.tv_usec * 1000ULL;
 
         char dateTimeBuffer[64];
         memset (dateTimeBuffer, 0, sizeof dateTimeBuffer);
         size_t nBytes = snprintf (dateTimeBuffer,
                                   sizeof dateTimeBuffer,
-                                  "%04u-%02u-%02u %02u:%02u:%02u.%06u",
+                                  "%04u-%02u-%02u %02u:%02u:%02u.%09u",
                                   mTimee.tm_year + 1900,
                                   mTimee.tm_mon + 1,
                                   mTimee.tm_mday,
                                   mTimee.tm_hour,
                                   mTimee.tm_min,
                                   mTimee.tm_sec,
-                                  (unsigned int)mTv.tv_usec);
+                                  (unsigned int)mTv.tv_usec * 1000);
         
         timeString = string (dateTimeBuffer, nBytes);
     }
@@ -193,3 +193,80 @@ TEST_F(formatScannerTestHarness, TEST_SCANNER_HANDLES_EMPTY_FORMAT)
 
     ASSERT_STREQ(log.c_str(), "");
 }
+
+TEST_F(formatScannerTestHarness, TEST_SCANNER_HANDLES_LITERALS_BETWEEN_TOKENS)
+{
+    string format = "[{severity}] {name}| {message} <end>";
+    string message = "message";
+
+    string log = logHandler::toString (format,
+                                       logSeverity::WARN,
+                                       "TEST",
+                                       mTime,
+                                       message.c_str(),
+                                       message.size ());
+
+    ASSERT_STREQ(log.c_str(), "[WARN] TEST| message <end>");
+}
+
+TEST_F(formatScannerTestHarness, TEST_COMPILED_FORMAT_IS_REUSABLE)
+{
+    logFormat format ("{name}: {message}");
+    string message = "message";
+
+    string log;
+    format.render (log,
+                   logSeverity::INFO,
+                   "ONE",
+                   mTime,
+                   message.c_str (),
+                   message.size ());
+    log.clear ();
+    format.render (log,
+                   logSeverity::INFO,
+                   "TWO",
+                   mTime,
+                   message.c_str (),
+                   message.size ());
+
+    ASSERT_STREQ(log.c_str(), "TWO: message");
+}
+
+TEST_F(formatScannerTestHarness, TEST_CACHED_TIMESTAMP_FOLLOWS_SECOND_CHANGE)
+{
+    logFormat format ("{time}");
+    string message = "message";
+
+    // same second, different nanos, then the next second
+    uint64_t times[] = { mTime,
+                         mTime - (mTime % 1000000000) + 7,
+                         mTime + 1000000000 };
+    for (size_t i = 0; i < sizeof times / sizeof times[0]; i++)
+    {
+        time_t t = times[i] / 1000000000;
+        struct tm tm_time;
+        gmtime_r (&t, &tm_time);
+
+        char expected[64];
+        snprintf (expected,
+                  sizeof expected,
+                  "%04u-%02u-%02u %02u:%02u:%02u.%09u",
+                  tm_time.tm_year + 1900,
+                  tm_time.tm_mon + 1,
+                  tm_time.tm_mday,
+                  tm_time.tm_hour,
+                  tm_time.tm_min,
+                  tm_time.tm_sec,
+                  (unsigned int)(times[i] % 1000000000));
+
+        string log;
+        format.render (log,
+                       logSeverity::INFO,
+                       "TEST",
+                       times[i],
+                       message.c_str (),
+                       message.size ());
+
+        ASSERT_STREQ(log.c_str(), expected);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logClock.h"
+
+using namespace neueda;
+using namespace std;
+
+// how far a converted time may be from CLOCK_REALTIME read alongside it
+static const int64_t kToleranceNanos = 20 * 1000 * 1000;
+
+class logClockTestHarness : public ::testing::Test
+{
+protected:
+    virtual void TearDown ()
+    {
+        logClock::setSource (logClock::CLOCK_SOURCE_REALTIME);
+    }
+
+    void expectNearRealtime ()
+    {
+        int64_t before = logClock::clockNanos (CLOCK_REALTIME);
+        uint64_t time = logClock::toNanos (logClock::now ());
+        int64_t after = logClock::clockNanos (CLOCK_REALTIME);
+
+        EXPECT_GE ((int64_t)time, before - kToleranceNanos);
+        EXPECT_LE ((int64_t)time, after + kToleranceNanos);
+    }
+};
+
+TEST_F(logClockTestHarness, TEST_PARSE_SOURCE)
+{
+    logClock::source s;
+    ASSERT_TRUE (logClock::parseSource ("realtime-coarse", s));
+    ASSERT_EQ (s, logClock::CLOCK_SOURCE_REALTIME_COARSE);
+    ASSERT_TRUE (logClock::parseSource ("tsc", s));
+    ASSERT_EQ (s, logClock::CLOCK_SOURCE_TSC);
+    ASSERT_FALSE (logClock::parseSource ("sundial", s));
+}
+
+TEST_F(logClockTestHarness, TEST_NANOS_PASS_THROUGH)
+{
+    uint64_t time = 1234567890123456789ULL;
+    ASSERT_EQ (logClock::toNanos (time), time);
+}
+
+TEST_F(logClockTestHarness, TEST_SOURCES_TRACK_REALTIME)
+{
+    logClock::source sources[] = { logClock::CLOCK_SOURCE_REALTIME,
+                                   logClock::CLOCK_SOURCE_REALTIME_COARSE,
+                                   logClock::CLOCK_SOURCE_MONOTONIC };
+
+    for (size_t i = 0; i < sizeof sources / sizeof sources[0]; i++)
+    {
+        ASSERT_TRUE (logClock::setSource (sources[i]));
+        expectNearRealtime ();
+    }
+}
+
+TEST_F(logClockTestHarness, TEST_TSC_CONVERTED_ON_CONSUMER)
+{
+    if (!logClock::setSource (logClock::CLOCK_SOURCE_TSC))
+    {
+        // no invariant tsc, loggers stay on the realtime clock
+        ASSERT_EQ (logClock::getSource (), logClock::CLOCK_SOURCE_REALTIME);
+        return;
+    }
+
+    uint64_t raw = logClock::now ();
+    expectNearRealtime ();
+
+    // a reading taken before a resync still converts to about the same
+    uint64_t first = logClock::toNanos (raw);
+    logClock::resync ();
+    int64_t drift = (int64_t)(logClock::toNanos (raw) - first);
+    EXPECT_LT (drift < 0 ? -drift : drift, kToleranceNanos);
+
+    // and time keeps moving forward
+    uint64_t later = logClock::toNanos (logClock::now ());
+    EXPECT_GT (later, first);
+}
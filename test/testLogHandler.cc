@@ -6,6 +6,17 @@
 #include <gtest/gtest.h>
 
 #include "logger.h"
+#include "fileLogHandler.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
 using namespace neueda;
 using namespace std;
@@ -685,3 +696,520 @@ TEST_F(logHandlerTestHarness, TEST_HANDLER_IGNORES_ERROR_LEVEL_SET_TO_FATAL)
     EXPECT_CALL (*handler, teardown ()).Times (1);
     logService.removeHandler (handler);
 }
+
+TEST_F(logHandlerTestHarness, TEST_DEFAULT_BATCH_SKIPS_DISABLED_LEVELS)
+{
+    testLogHandler handler;
+    handler.setLevel (logSeverity::INFO);
+
+    logBatchEntry entries[] = {
+        { logSeverity::DEBUG, "TEST", 0, "HELLO WORLD 1", 13 },
+        { logSeverity::INFO, "TEST", 0, "HELLO WORLD 2", 13 },
+        { logSeverity::ERROR, "TEST", 0, "HELLO WORLD 3", 13 }
+    };
+
+    EXPECT_CALL (handler, handle (logSeverity::DEBUG,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_))
+        .Times (0);
+    EXPECT_CALL (handler, handle (logSeverity::INFO,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_))
+        .Times (1);
+    EXPECT_CALL (handler, handle (logSeverity::ERROR,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_,
+                                  ::testing::_))
+        .Times (1);
+
+    handler.handleBatch (entries, 3);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_BATCH_ROLLS_LIKE_SINGLE_RECORDS)
+{
+    char path[] = "/tmp/testLogHandlerBatchXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    // "HELLO WORLD n\n" is 14 bytes, the second record crosses the limit
+    fileLogHandler handler (path, 20, 2);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setLevel (logSeverity::INFO);
+    ASSERT_TRUE (handler.setup ());
+
+    logBatchEntry entries[] = {
+        { logSeverity::INFO, "TEST", 0, "HELLO WORLD 1", 13 },
+        { logSeverity::INFO, "TEST", 0, "HELLO WORLD 2", 13 },
+        { logSeverity::DEBUG, "TEST", 0, "HELLO WORLD X", 13 },
+        { logSeverity::INFO, "TEST", 0, "HELLO WORLD 3", 13 }
+    };
+    handler.handleBatch (entries, 4);
+    handler.teardown ();
+
+    string rolled (path);
+    rolled.append (".1");
+
+    char buffer[64];
+    FILE* f = fopen (rolled.c_str (), "r");
+    ASSERT_TRUE (f != NULL);
+    size_t n = fread (buffer, 1, sizeof buffer, f);
+    fclose (f);
+    ASSERT_EQ (string (buffer, n), "HELLO WORLD 1\nHELLO WORLD 2\n");
+
+    f = fopen (path, "r");
+    ASSERT_TRUE (f != NULL);
+    n = fread (buffer, 1, sizeof buffer, f);
+    fclose (f);
+    ASSERT_EQ (string (buffer, n), "HELLO WORLD 3\n");
+
+    unlink (rolled.c_str ());
+    unlink (path);
+}
+
+static string
+readFile (const string& path)
+{
+    // gzread passes files that are not compressed through as they are
+    string contents;
+    gzFile f = gzopen (path.c_str (), "rb");
+    if (f == NULL)
+        return contents;
+
+    char buffer[256];
+    int n;
+    while ((n = gzread (f, buffer, sizeof buffer)) > 0)
+        contents.append (buffer, n);
+    gzclose (f);
+    return contents;
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_BUFFERS_UNTIL_FLUSH_LEVEL)
+{
+    char path[] = "/tmp/testLogHandlerBufferXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    fileLogHandler handler (path, 0, 0);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setBuffer (1024, 0, logSeverity::ERROR);
+    ASSERT_TRUE (handler.setup ());
+
+    handler.handle (logSeverity::INFO, "TEST", 0, "HELLO WORLD 1", 13);
+    ASSERT_EQ (readFile (path), "");
+
+    // an error takes what is pending out with it
+    handler.handle (logSeverity::ERROR, "TEST", 0, "HELLO WORLD 2", 13);
+    ASSERT_EQ (readFile (path), "HELLO WORLD 1\nHELLO WORLD 2\n");
+
+    handler.handle (logSeverity::INFO, "TEST", 0, "HELLO WORLD 3", 13);
+    handler.teardown ();
+    ASSERT_EQ (readFile (path), "HELLO WORLD 1\nHELLO WORLD 2\nHELLO WORLD 3\n");
+
+    unlink (path);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_FLUSHES_IDLE_BUFFER)
+{
+    char path[] = "/tmp/testLogHandlerIdleXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    fileLogHandler handler (path, 0, 0);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setBuffer (1024, 10, logSeverity::ERROR);
+    ASSERT_TRUE (handler.setup ());
+
+    handler.handle (logSeverity::INFO, "TEST", 0, "HELLO WORLD 1", 13);
+    for (int i = 0; i < 1000 && readFile (path).empty (); i++)
+        usleep (1000);
+    ASSERT_EQ (readFile (path), "HELLO WORLD 1\n");
+
+    handler.teardown ();
+    unlink (path);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_WRITER_THREAD_ROLLS_IN_ORDER)
+{
+    char path[] = "/tmp/testLogHandlerWriterXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    // small buffers so the caller keeps catching the writer up
+    fileLogHandler handler (path, 1000, 2);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setBuffer (64, 0, logSeverity::ERROR);
+    handler.setWriterThread (true);
+    ASSERT_TRUE (handler.setup ());
+
+    string expected;
+    char message[32];
+    for (int i = 0; i < 200; i++)
+    {
+        int n = snprintf (message, sizeof message, "HELLO WORLD %03d", i);
+        handler.handle (logSeverity::INFO, "TEST", 0, message, n);
+        expected.append (message, n);
+        expected.push_back ('\n');
+    }
+    handler.teardown ();
+
+    // 16 bytes a line, the file rolls after the line crossing 1000
+    string rolled (path);
+    rolled.append (".1");
+    string last = readFile (path);
+    string previous = readFile (rolled);
+    ASSERT_EQ (previous, expected.substr (2 * 1008, 1008));
+    ASSERT_EQ (last, expected.substr (3 * 1008));
+
+    unlink (rolled.c_str ());
+    unlink (path);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_MAPPED_TRUNCATES_ON_CLOSE)
+{
+    char path[] = "/tmp/testLogHandlerMappedXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    fileLogHandler handler (path, 1000, 2);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setMapped (true);
+    ASSERT_TRUE (handler.setup ());
+
+    string expected;
+    char message[32];
+    for (int i = 0; i < 100; i++)
+    {
+        int n = snprintf (message, sizeof message, "HELLO WORLD %03d", i);
+        handler.handle (logSeverity::INFO, "TEST", 0, message, n);
+        expected.append (message, n);
+        expected.push_back ('\n');
+    }
+    handler.teardown ();
+
+    // both files cut back from their preallocated size
+    string rolled (path);
+    rolled.append (".1");
+    ASSERT_EQ (readFile (rolled), expected.substr (0, 1008));
+    ASSERT_EQ (readFile (path), expected.substr (1008));
+
+    unlink (rolled.c_str ());
+    unlink (path);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_MAPPED_WINDOW_FITS_LIMIT)
+{
+    char path[] = "/tmp/testLogHandlerMappedXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+
+    fileLogHandler handler (path, 1000, 2);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setMapped (true);
+    ASSERT_TRUE (handler.setup ());
+
+    // just under the limit, the error is written out at once
+    string expected;
+    char message[32];
+    for (int i = 0; i < 62; i++)
+    {
+        int n = snprintf (message, sizeof message, "HELLO WORLD %03d", i);
+        handler.handle (i == 61 ? logSeverity::ERROR : logSeverity::INFO,
+                        "TEST",
+                        0,
+                        message,
+                        n);
+        expected.append (message, n);
+        expected.push_back ('\n');
+    }
+
+    // a small segment is not grown to a whole window
+    struct stat st;
+    ASSERT_EQ (stat (path, &st), 0);
+    ASSERT_GT ((uint64_t)st.st_size, 1000u);
+    ASSERT_LE ((uint64_t)st.st_size, (uint64_t)sysconf (_SC_PAGESIZE));
+
+    handler.teardown ();
+    ASSERT_EQ (readFile (path), expected);
+
+    unlink (path);
+}
+
+static bool
+fileExists (const string& path)
+{
+    struct stat st;
+    return stat (path.c_str (), &st) == 0;
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_SEQUENCE_NAMING_KEEPS_COUNT)
+{
+    char dir[] = "/tmp/testLogHandlerSegmentsXXXXXX";
+    ASSERT_TRUE (mkdtemp (dir) != NULL);
+    string path (dir);
+    path.append ("/app.log");
+
+    string format ("{message}");
+    string expected;
+    char message[32];
+
+    fileLogHandler* handler = new fileLogHandler (path, 100, 3);
+    handler->setFormat (format);
+    handler->setNaming (logSegments::NAMING_SEQUENCE, true);
+    ASSERT_TRUE (handler->setup ());
+
+    // seven lines a file, fifteen files
+    for (int i = 0; i < 100; i++)
+    {
+        int n = snprintf (message, sizeof message, "HELLO WORLD %03d", i);
+        handler->handle (logSeverity::INFO, "TEST", 0, message, n);
+        expected.append (message, n);
+        expected.push_back ('\n');
+    }
+    delete handler;
+
+    // the two before the last compressed, the rest gone
+    ASSERT_FALSE (fileExists (path));
+    ASSERT_FALSE (fileExists (path + ".12.gz"));
+    ASSERT_EQ (readFile (path + ".13.gz"), expected.substr (12 * 112, 112));
+    ASSERT_EQ (readFile (path + ".14.gz"), expected.substr (13 * 112, 112));
+    ASSERT_EQ (readFile (path + ".15"), expected.substr (14 * 112));
+    ASSERT_FALSE (fileExists (path + ".16"));
+
+    // numbering goes on from the files already there
+    handler = new fileLogHandler (path, 100, 3);
+    handler->setFormat (format);
+    handler->setNaming (logSegments::NAMING_SEQUENCE, true);
+    ASSERT_TRUE (handler->setup ());
+    handler->handle (logSeverity::INFO, "TEST", 0, "AGAIN", 5);
+    delete handler;
+
+    ASSERT_FALSE (fileExists (path + ".13.gz"));
+    ASSERT_EQ (readFile (path + ".15.gz"), expected.substr (14 * 112));
+    ASSERT_EQ (readFile (path + ".16"), "AGAIN\n");
+
+    unlink ((path + ".14.gz").c_str ());
+    unlink ((path + ".15.gz").c_str ());
+    unlink ((path + ".16").c_str ());
+    ASSERT_EQ (rmdir (dir), 0);
+}
+
+static string
+periodName (const string& path, time_t start)
+{
+    char stamp[32];
+    struct tm tm;
+    gmtime_r (&start, &tm);
+    strftime (stamp, sizeof stamp, ".%Y%m%d-%H%M%S", &tm);
+    return path + stamp;
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_ROTATES_ON_TIME_BOUNDARIES)
+{
+    char dir[] = "/tmp/testLogHandlerRotateXXXXXX";
+    ASSERT_TRUE (mkdtemp (dir) != NULL);
+    string path (dir);
+    path.append ("/app.log");
+
+    fileLogHandler* handler = new fileLogHandler (path, 0, 0);
+    string format ("{message}");
+    handler->setFormat (format);
+    handler->setNaming (logSegments::NAMING_TIMESTAMP, false);
+    handler->setRotateInterval (60);
+    ASSERT_TRUE (handler->setup ());
+
+    // lines roll by their own time, a couple of minutes ahead
+    time_t base = (time (NULL) / 60 + 2) * 60;
+    uint64_t nanos = (uint64_t)base * 1000000000;
+    handler->handle (logSeverity::INFO, "TEST", nanos + 1000000000ull, "ONE", 3);
+    handler->handle (logSeverity::INFO, "TEST", nanos + 59999999999ull, "TWO", 3);
+    handler->handle (logSeverity::INFO, "TEST", nanos + 60000000000ull, "THREE", 5);
+
+    // the first file is closed, a late line goes to the current one
+    handler->handle (logSeverity::INFO, "TEST", nanos + 2000000000ull, "LATE", 4);
+    delete handler;
+
+    ASSERT_EQ (readFile (periodName (path, base)), "ONE\nTWO\n");
+    ASSERT_EQ (readFile (periodName (path, base + 60)), "THREE\nLATE\n");
+
+    // the next file was opened ahead and removed unused
+    ASSERT_FALSE (fileExists (periodName (path, base + 120)));
+
+    DIR* d = opendir (dir);
+    ASSERT_TRUE (d != NULL);
+    struct dirent* entry;
+    while ((entry = readdir (d)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+            unlink ((string (dir) + "/" + entry->d_name).c_str ());
+    }
+    closedir (d);
+    ASSERT_EQ (rmdir (dir), 0);
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_REPORTS_FAILED_WRITES)
+{
+    // every write to /dev/full fails with ENOSPC
+    fileLogHandler* handler = new fileLogHandler ("/dev/full", 0, 0);
+    string format ("{message}");
+    handler->setFormat (format);
+    ASSERT_TRUE (handler->setup ());
+    handler->handle (logSeverity::INFO, "TEST", 0, "LOST", 4);
+    ASSERT_EQ (handler->getLastError (), strerror (ENOSPC));
+    delete handler;
+
+    // and the same from the writer thread
+    handler = new fileLogHandler ("/dev/full", 0, 0);
+    handler->setFormat (format);
+    handler->setWriterThread (true);
+    ASSERT_TRUE (handler->setup ());
+    handler->handle (logSeverity::INFO, "TEST", 0, "LOST", 4);
+    handler->teardown ();
+    ASSERT_EQ (handler->getLastError (), strerror (ENOSPC));
+    delete handler;
+}
+
+static size_t
+countEntries (const string& dir)
+{
+    size_t count = 0;
+    DIR* d = opendir (dir.c_str ());
+    struct dirent* entry;
+    while ((entry = readdir (d)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+            count++;
+    }
+    closedir (d);
+    return count;
+}
+
+TEST_F(logHandlerTestHarness, TEST_SEGMENTS_TIMESTAMP_NAMES_AT_ROLL)
+{
+    char dir[] = "/tmp/testLogHandlerStampXXXXXX";
+    ASSERT_TRUE (mkdtemp (dir) != NULL);
+    string path (dir);
+    path.append ("/app.log");
+
+    // left by an earlier run, .10 is the newest
+    const char* earlier[] = { ".20200101-000000",
+                              ".20200101-000000.2",
+                              ".20200101-000000.10" };
+    for (size_t i = 0; i < 3; i++)
+        close (open ((path + earlier[i]).c_str (), O_WRONLY | O_CREAT, 0666));
+
+    logSegments segments (path,
+                          logSegments::NAMING_TIMESTAMP,
+                          O_WRONLY,
+                          2,
+                          false);
+    string err;
+    ASSERT_TRUE (segments.start (err));
+
+    string name;
+    int fd = segments.next (name, err, 0);
+    ASSERT_NE (fd, -1);
+
+    // the oldest go, and nothing is opened ahead with a stale time
+    for (int i = 0; i < 1000 && countEntries (dir) > 2; i++)
+        usleep (1000);
+    usleep (10000);
+    ASSERT_EQ (countEntries (dir), 2u);
+    ASSERT_TRUE (fileExists (path + earlier[2]));
+    ASSERT_TRUE (fileExists (name));
+
+    close (fd);
+    segments.stop ();
+
+    unlink ((path + earlier[2]).c_str ());
+    unlink (name.c_str ());
+    ASSERT_EQ (rmdir (dir), 0);
+}
+
+TEST_F(logHandlerTestHarness, TEST_SEGMENTS_STOP_AFTER_FAILED_OPEN)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        char dir[] = "/tmp/testLogHandlerGoneXXXXXX";
+        ASSERT_TRUE (mkdtemp (dir) != NULL);
+        string path (dir);
+        path.append ("/app.log");
+
+        logSegments* segments = new logSegments (path,
+                                                 logSegments::NAMING_SEQUENCE,
+                                                 O_WRONLY,
+                                                 0,
+                                                 false);
+        string err;
+        ASSERT_TRUE (segments->start (err));
+
+        // nothing can be created, ahead or not
+        ASSERT_EQ (rmdir (dir), 0);
+        string name;
+        ASSERT_EQ (segments->next (name, err, 0), -1);
+
+        // returns while the thread is failing to open ahead
+        delete segments;
+    }
+}
+
+TEST_F(logHandlerTestHarness, TEST_FILE_HANDLER_WRITES_GZIP_MEMBERS)
+{
+    char path[] = "/tmp/testLogHandlerGzipXXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_NE (fd, -1);
+    close (fd);
+    unlink (path);
+
+    fileLogHandler handler (path, 1000, 2);
+    string format ("{message}");
+    handler.setFormat (format);
+    handler.setBuffer (256, 0, logSeverity::FATAL);
+    handler.setCompressed (true);
+    ASSERT_TRUE (handler.setup ());
+
+    string expected;
+    char message[32];
+    for (int i = 0; i < 100; i++)
+    {
+        int n = snprintf (message, sizeof message, "HELLO WORLD %03d", i);
+        handler.handle (logSeverity::INFO, "TEST", 0, message, n);
+        expected.append (message, n);
+        expected.push_back ('\n');
+    }
+    handler.teardown ();
+
+    // rolled on the size before compression, one member per buffer
+    string current (path);
+    current.append (".gz");
+    string rolled (path);
+    rolled.append (".1.gz");
+    ASSERT_EQ (readFile (rolled), expected.substr (0, 1008));
+    ASSERT_EQ (readFile (current), expected.substr (1008));
+
+    FILE* f = fopen (current.c_str (), "r");
+    ASSERT_TRUE (f != NULL);
+    ASSERT_EQ (fgetc (f), 0x1f);
+    ASSERT_EQ (fgetc (f), 0x8b);
+    fclose (f);
+    ASSERT_FALSE (fileExists (path));
+
+    unlink (rolled.c_str ());
+    unlink (current.c_str ());
+}
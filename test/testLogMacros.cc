@@ -0,0 +1,153 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+// everything below info is compiled out in this file
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_INFO
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logger.h"
+
+using namespace neueda;
+using namespace std;
+
+class macroLogHandler : public logHandler
+{
+public:
+    macroLogHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mLast.assign (message, message_len);
+        mCount++;
+    }
+
+    string  mLast;
+    int     mCount;
+};
+
+class logMacrosTestHarness : public ::testing::Test
+{
+protected:
+    virtual void SetUp ()
+    {
+        properties p;
+        p.setProperty ("lh.console.enabled", "false");
+
+        string err;
+        ASSERT_TRUE (logService::get ().configure (p, err));
+        ASSERT_TRUE (logService::get ().addHandler (&mHandler, err, false));
+
+        mLogger = logService::getLogger ("TEST_LOG_MACROS");
+        mLogger->setLevel (logSeverity::TRACE);
+        mEvaluated = 0;
+    }
+
+    virtual void TearDown ()
+    {
+        logService::get ().removeHandler (&mHandler);
+    }
+
+    int evaluate ()
+    {
+        return ++mEvaluated;
+    }
+
+    macroLogHandler mHandler;
+    logger*         mLogger;
+    int             mEvaluated;
+};
+
+TEST_F(logMacrosTestHarness, TEST_ENABLED_LEVEL_LOGS)
+{
+    LOG_INFO (mLogger, "call %d", evaluate ());
+    LOG_WARN_STREAM (mLogger) << "stream " << evaluate () << logger::endl;
+
+    ASSERT_EQ (mEvaluated, 2);
+    ASSERT_EQ (mHandler.mCount, 2);
+    ASSERT_EQ (mHandler.mLast, "stream 2");
+}
+
+TEST_F(logMacrosTestHarness, TEST_DISABLED_LEVEL_SKIPS_ARGUMENTS)
+{
+    mLogger->setLevel (logSeverity::ERROR);
+
+    LOG_INFO (mLogger, "call %d", evaluate ());
+    LOG_WARN_STREAM (mLogger) << "stream " << evaluate () << logger::endl;
+
+    ASSERT_EQ (mEvaluated, 0);
+    ASSERT_EQ (mHandler.mCount, 0);
+}
+
+TEST_F(logMacrosTestHarness, TEST_BELOW_MIN_LEVEL_IS_COMPILED_OUT)
+{
+    // enabled at runtime, but removed by LOGGER_MIN_LEVEL
+    LOG_TRACE (mLogger, "call %d", evaluate ());
+    LOG_DEBUG (mLogger, "call %d", evaluate ());
+    LOG_DEBUG_STREAM (mLogger) << "stream " << evaluate () << logger::endl;
+
+    ASSERT_EQ (mEvaluated, 0);
+    ASSERT_EQ (mHandler.mCount, 0);
+}
+
+TEST_F(logMacrosTestHarness, TEST_STREAM_MACRO_IN_UNBRACED_IF)
+{
+    bool taken = false;
+    if (mEvaluated != 0)
+        LOG_INFO_STREAM (mLogger) << "not reached" << logger::endl;
+    else
+        taken = true;
+
+    ASSERT_TRUE (taken);
+    ASSERT_EQ (mHandler.mCount, 0);
+}
+
+TEST_F(logMacrosTestHarness, TEST_EVERY_N_REPORTS_SUPPRESSED)
+{
+    for (int i = 0; i < 10; i++)
+        LOG_WARN_EVERY_N (mLogger, 4, "tick %d", i);
+
+    ASSERT_EQ (mHandler.mCount, 3);
+    ASSERT_EQ (mHandler.mLast, "tick 8 (3 suppressed)");
+}
+
+TEST_F(logMacrosTestHarness, TEST_FIRST_N_THEN_EVERY_M)
+{
+    for (int i = 0; i < 10; i++)
+        LOG_WARN_FIRST_N (mLogger, 2, 3, "tick %d", i);
+
+    // 0 and 1, then every third
+    ASSERT_EQ (mHandler.mCount, 4);
+    ASSERT_EQ (mHandler.mLast, "tick 7 (2 suppressed)");
+}
+
+TEST_F(logMacrosTestHarness, TEST_RATE_ALLOWS_A_BURST)
+{
+    for (int i = 0; i < 10; i++)
+        LOG_ERROR_RATE (mLogger, 1, 3, "tick %d", i);
+
+    ASSERT_EQ (mHandler.mCount, 3);
+    ASSERT_EQ (mHandler.mLast, "tick 2");
+}
+
+TEST_F(logMacrosTestHarness, TEST_LIMITED_SKIPS_DISABLED_LEVELS)
+{
+    mLogger->setLevel (logSeverity::ERROR);
+    for (int i = 0; i < 10; i++)
+        LOG_WARN_EVERY_N (mLogger, 2, "tick %d", evaluate ());
+    ASSERT_EQ (mEvaluated, 0);
+
+    // disabled calls were not counted as suppressed
+    mLogger->setLevel (logSeverity::TRACE);
+    LOG_WARN_EVERY_N (mLogger, 2, "tick %d", evaluate ());
+    ASSERT_EQ (mHandler.mLast, "tick 1");
+
+    LOG_DEBUG_EVERY_N (mLogger, 1, "call %d", evaluate ());
+    ASSERT_EQ (mEvaluated, 1);
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logQueue.h"
+#include "logRegistry.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+using namespace neueda;
+using namespace std;
+
+static const size_t kProducers = 4;
+static const size_t kItemsPerProducer = 20000;
+
+struct producerArgs
+{
+    logQueue*   mQueue;
+    size_t      mId;
+    size_t      mItems;
+};
+
+static void*
+produce (void* closure)
+{
+    producerArgs* args = static_cast<producerArgs*>(closure);
+
+    char name = (char)('a' + args->mId);
+    char message[64];
+    for (size_t i = 0; i < args->mItems; i++)
+    {
+        // varying lengths so records wrap the ring at odd offsets
+        int len = snprintf (message, sizeof message, "%zu %*s", i, (int)(i % 40), "");
+
+        size_t length = logRecord::sizeFor (1, len);
+        logRecord* record = args->mQueue->claim (length, logSeverity::INFO);
+        char* body = record->init (logRegistry::kNoId, &name, 1, logSeverity::INFO, i);
+        memcpy (body, message, len);
+        args->mQueue->publish (record, length, record->finish (len));
+    }
+    return NULL;
+}
+
+static void
+runProducers (logWaiter::strategy strategy, size_t items)
+{
+    // smallest ring so producers regularly find it full
+    logQueue queue (0, 64, strategy);
+
+    sbfThread threads[kProducers];
+    producerArgs args[kProducers];
+    for (size_t i = 0; i < kProducers; i++)
+    {
+        args[i].mQueue = &queue;
+        args[i].mId = i;
+        args[i].mItems = items;
+        ASSERT_EQ (sbfThread_create (&threads[i], produce, &args[i]), 0);
+    }
+
+    vector<uint64_t> next (kProducers, 0);
+    for (size_t n = 0; n < kProducers * items; n++)
+    {
+        const logRecord* record = queue.take ();
+        ASSERT_TRUE (record != NULL);
+
+        size_t id = record->getName ()[0] - 'a';
+        ASSERT_LT (id, kProducers);
+        // each producer's records come out in the order they went in
+        ASSERT_EQ (record->mTime, next[id]);
+        size_t seq;
+        ASSERT_EQ (sscanf (record->getMessage (), "%zu", &seq), 1);
+        ASSERT_EQ (seq, next[id]);
+        next[id]++;
+
+        queue.release ();
+    }
+
+    for (size_t i = 0; i < kProducers; i++)
+        sbfThread_join (threads[i]);
+
+    queue.stop ();
+    ASSERT_TRUE (queue.take () == NULL);
+}
+
+TEST(logQueueTest, TEST_MPSC_KEEPS_PRODUCER_ORDER_BLOCK)
+{
+    runProducers (logWaiter::WAIT_BLOCK, kItemsPerProducer);
+}
+
+TEST(logQueueTest, TEST_MPSC_KEEPS_PRODUCER_ORDER_YIELD)
+{
+    runProducers (logWaiter::WAIT_YIELD, kItemsPerProducer);
+}
+
+TEST(logQueueTest, TEST_MPSC_KEEPS_PRODUCER_ORDER_SPIN)
+{
+    // a spinning consumer hogs a core, keep this short on small machines
+    runProducers (logWaiter::WAIT_SPIN, kItemsPerProducer / 20);
+}
+
+TEST(logQueueTest, TEST_MPSC_LONG_AND_ABANDONED_RECORDS)
+{
+    logQueue queue (0, 1024, logWaiter::WAIT_BLOCK);
+
+    // the largest record allowed, a reservation given back and a record
+    // published shorter than it was claimed
+    size_t longLen = queue.maxRecordSize () - logRecord::sizeFor (4, 0);
+    string longMessage (longLen, 'x');
+
+    size_t length = logRecord::sizeFor (4, longLen);
+    logRecord* record = queue.claim (length, logSeverity::INFO);
+    memcpy (record->init (logRegistry::kNoId, "long", 4, logSeverity::INFO, 1),
+            longMessage.data (),
+            longLen);
+    queue.publish (record, length, record->finish (longLen));
+
+    record = queue.claim (length, logSeverity::INFO);
+    queue.abandon (record, length);
+
+    record = queue.claim (length, logSeverity::INFO);
+    memcpy (record->init (logRegistry::kNoId, "short", 5, logSeverity::WARN, 2), "hi", 2);
+    queue.publish (record, length, record->finish (2));
+
+    queue.stop ();
+
+    const logRecord* records[4];
+    ASSERT_EQ (queue.takeBatch (records, 4), 2u);
+    ASSERT_STREQ (records[0]->getName (), "long");
+    ASSERT_EQ (string (records[0]->getMessage (), records[0]->mMessageLen),
+               longMessage);
+    ASSERT_STREQ (records[1]->getName (), "short");
+    ASSERT_STREQ (records[1]->getMessage (), "hi");
+    queue.releaseBatch ();
+
+    ASSERT_EQ (queue.takeBatch (records, 4), 0u);
+}
+
+static bool
+publish (logQueue& queue, logSeverity::level severity, uint64_t time)
+{
+    size_t length = logRecord::sizeFor (1, 0);
+    logRecord* record = queue.claim (length, severity);
+    if (record == NULL)
+        return false;
+
+    record->init (logRegistry::kNoId, "q", 1, severity, time);
+    queue.publish (record, length, record->finish (0));
+    return true;
+}
+
+TEST(logQueueTest, TEST_OVERFLOW_DROP_NEWEST)
+{
+    logQueue queue (0,
+                    2,
+                    logWaiter::WAIT_BLOCK,
+                    logOverflow::OVERFLOW_DROP_NEWEST);
+
+    ASSERT_TRUE (publish (queue, logSeverity::INFO, 0));
+    ASSERT_TRUE (publish (queue, logSeverity::INFO, 1));
+    ASSERT_FALSE (publish (queue, logSeverity::FATAL, 2));
+    ASSERT_EQ (queue.getOverflow ().getDropped (), 1u);
+
+    // the records already queued are kept
+    ASSERT_EQ (queue.take ()->mTime, 0u);
+    queue.release ();
+    ASSERT_TRUE (publish (queue, logSeverity::INFO, 3));
+}
+
+TEST(logQueueTest, TEST_OVERFLOW_DROP_BELOW_SEVERITY)
+{
+    logQueue queue (0,
+                    1,
+                    logWaiter::WAIT_BLOCK,
+                    logOverflow::OVERFLOW_DROP_BELOW_SEVERITY,
+                    logSeverity::ERROR);
+
+    ASSERT_TRUE (publish (queue, logSeverity::INFO, 0));
+    ASSERT_FALSE (publish (queue, logSeverity::WARN, 1));
+    ASSERT_EQ (queue.getOverflow ().getDropped (), 1u);
+}
+
+static void*
+publishError (void* closure)
+{
+    publish (*static_cast<logQueue*>(closure), logSeverity::ERROR, 99);
+    return NULL;
+}
+
+TEST(logQueueTest, TEST_OVERFLOW_DROP_OLDEST)
+{
+    logQueue queue (0,
+                    4,
+                    logWaiter::WAIT_BLOCK,
+                    logOverflow::OVERFLOW_DROP_OLDEST);
+
+    for (uint64_t i = 0; i < 4; i++)
+        ASSERT_TRUE (publish (queue, logSeverity::INFO, i));
+
+    // the producer waits until the consumer has discarded the oldest
+    // records, only as many as it needs room for
+    sbfThread thread;
+    ASSERT_EQ (sbfThread_create (&thread, publishError, &queue), 0);
+    usleep (10000);
+
+    uint64_t taken = 0;
+    uint64_t time;
+    do
+    {
+        time = queue.take ()->mTime;
+        queue.release ();
+        taken++;
+    } while (time != 99);
+    sbfThread_join (thread);
+
+    ASSERT_EQ (queue.getOverflow ().getDropped () + taken, 5u);
+    ASSERT_LT (queue.getOverflow ().getDropped (), 4u);
+}
+
+TEST(logQueueTest, TEST_PARSE_WAIT_STRATEGY)
+{
+    logWaiter::strategy strategy;
+    ASSERT_TRUE (logWaiter::parseStrategy ("yield", strategy));
+    ASSERT_EQ (strategy, logWaiter::WAIT_YIELD);
+    ASSERT_FALSE (logWaiter::parseStrategy ("sometimes", strategy));
+}
+
+TEST(logQueueTest, TEST_PARSE_OVERFLOW_POLICY)
+{
+    logOverflow::policy policy;
+    ASSERT_TRUE (logOverflow::parsePolicy ("drop-oldest", policy));
+    ASSERT_EQ (policy, logOverflow::OVERFLOW_DROP_OLDEST);
+    ASSERT_FALSE (logOverflow::parsePolicy ("drop-some", policy));
+}
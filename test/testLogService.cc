@@ -3,6 +3,7 @@
  */
 
 #include "logger.h"
+#include "logClock.h"
 #include "properties.h"
 
 #include <gmock/gmock.h>
@@ -12,9 +13,54 @@
 #include <fstream>
 #include <cstdio>
 #include <string>
+#include <unistd.h>
 
 using namespace neueda;
 
+class countingServiceHandler : public logHandler
+{
+public:
+    countingServiceHandler () : mCount (0), mTornDown (0), mLate (0) { }
+
+    bool setup ()
+    {
+        __sync_lock_test_and_set (&mTornDown, 0);
+        return true;
+    }
+
+    void teardown ()
+    {
+        __sync_lock_test_and_set (&mTornDown, 1);
+    }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        __sync_fetch_and_add (&mCount, 1);
+        if (mTornDown)
+            __sync_fetch_and_add (&mLate, 1);
+    }
+
+    volatile int    mCount;
+    volatile int    mTornDown;
+    volatile int    mLate;
+};
+
+static const int kLoggingThreads = 4;
+static const int kRecordsPerThread = 20000;
+
+static void*
+logRecords (void* closure)
+{
+    logger* log = static_cast<logger*>(closure);
+    for (int i = 0; i < kRecordsPerThread; i++)
+        log->info ("record %d", i);
+    return NULL;
+}
+
 class logServiceTestHarness : public ::testing::Test
 {
 protected:
@@ -38,3 +84,556 @@ TEST_F(logServiceTestHarness, TEST_CONFIGURE_SUCCEEDS)
     ASSERT_TRUE (ok);
     ASSERT_TRUE (err.empty ());
 }
+
+static void*
+configureQuietly (void* closure)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+
+    string err;
+    if (logService::get ().configure (p, err))
+        __sync_lock_test_and_set (static_cast<volatile int*>(closure), 1);
+    return NULL;
+}
+
+TEST_F(logServiceTestHarness, TEST_FAILED_CONFIGURE_RELEASES_SERVICE)
+{
+    properties bad;
+    bad.setProperty ("lh.console.enabled", "false");
+    bad.setProperty ("logger.service.queue.wait", "sometimes");
+
+    string err;
+    ASSERT_FALSE (mService->configure (bad, err));
+    ASSERT_EQ (err, "failed parsing property: queue.wait");
+
+    // the mutex is recursive, only another thread would see it held
+    volatile int configured = 0;
+    sbfThread thread;
+    ASSERT_EQ (sbfThread_create (&thread, configureQuietly, (void*)&configured), 0);
+    for (int i = 0; i < 5000 && !configured; i++)
+        usleep (1000);
+    ASSERT_EQ (configured, 1);
+    sbfThread_join (thread);
+}
+
+TEST_F(logServiceTestHarness, TEST_FAILED_HANDLER_SETUP_KEEPS_SERVICE)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.level.TEST_KEPT", "debug");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    countingServiceHandler handler;
+    handler.setLevel (logSeverity::TRACE);
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+
+    // the file cannot be opened, nothing else may change
+    properties bad;
+    bad.setProperty ("lh.console.enabled", "false");
+    bad.setProperty ("lh.file.enabled", "true");
+    bad.setProperty ("lh.file.path", "/nonexistent/testLogService.log");
+    bad.setProperty ("logger.level.TEST_KEPT", "warn");
+    bad.setProperty ("logger.service.clock", "monotonic");
+    ASSERT_FALSE (mService->configure (bad, err));
+
+    logger* log = logService::getLogger ("TEST_KEPT");
+    ASSERT_EQ (log->getLevel (), logSeverity::DEBUG);
+    ASSERT_EQ (logClock::getSource (), logClock::CLOCK_SOURCE_REALTIME);
+
+    log->debug ("still handled");
+    ASSERT_EQ (handler.mCount, 1);
+
+    mService->removeHandler (&handler);
+}
+
+class reentrantServiceHandler : public logHandler
+{
+public:
+    reentrantServiceHandler (logService* service) :
+        mService (service),
+        mCount (0)
+    {
+    }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        // add a handler on the first record and take it away on the next
+        string err;
+        int count = mCount++;
+        if (count == 0)
+            mService->addHandler (&mAdded, err, false);
+        else if (count == 1)
+            mService->removeHandler (&mAdded);
+    }
+
+    logService*             mService;
+    int                     mCount;
+    countingServiceHandler  mAdded;
+};
+
+TEST_F(logServiceTestHarness, TEST_HANDLER_CHANGES_FROM_A_HANDLER)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    reentrantServiceHandler handler (mService);
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+
+    logger* log = logService::getLogger ("TEST_HANDLER_REENTRANT");
+    log->info ("adds");
+    log->info ("removes");
+    log->info ("after");
+
+    // the added handler only ever saw what was logged while it was there
+    ASSERT_EQ (handler.mCount, 3);
+    ASSERT_LE (handler.mAdded.mCount, 1);
+
+    mService->removeHandler (&handler);
+}
+
+TEST_F(logServiceTestHarness, TEST_HANDLER_CHANGES_WHILE_LOGGING)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    countingServiceHandler steady;
+    countingServiceHandler churned;
+    ASSERT_TRUE (mService->addHandler (&steady, err, false));
+
+    logger* log = logService::getLogger ("TEST_HANDLER_CHANGES");
+
+    sbfThread threads[kLoggingThreads];
+    for (int i = 0; i < kLoggingThreads; i++)
+        ASSERT_EQ (sbfThread_create (&threads[i], logRecords, log), 0);
+
+    // add and remove a handler while the threads log, it must never be
+    // handed a record once removeHandler has returned
+    for (int i = 0; i < 200; i++)
+    {
+        ASSERT_TRUE (mService->addHandler (&churned, err, false));
+        mService->removeHandler (&churned);
+    }
+
+    for (int i = 0; i < kLoggingThreads; i++)
+        sbfThread_join (threads[i]);
+
+    mService->removeHandler (&steady);
+
+    ASSERT_EQ (steady.mCount, kLoggingThreads * kRecordsPerThread);
+    ASSERT_EQ (steady.mLate, 0);
+    ASSERT_EQ (churned.mLate, 0);
+}
+
+class gatedServiceHandler : public logHandler
+{
+public:
+    gatedServiceHandler () : mEntered (0), mOpen (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        __sync_lock_test_and_set (&mEntered, 1);
+        while (!mOpen)
+            usleep (1000);
+
+        mMessages.push_back (string (message, message_len));
+    }
+
+    vector<string>  mMessages;
+    volatile int    mEntered;
+    volatile int    mOpen;
+};
+
+TEST_F(logServiceTestHarness, TEST_OVERFLOW_REPORTS_DROPPED_RECORDS)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+    p.setProperty ("logger.service.queue.capacity", "4");
+    p.setProperty ("logger.service.queue.overflow", "drop-newest");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    gatedServiceHandler handler;
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+
+    logger* log = logService::getLogger ("TEST_OVERFLOW");
+
+    // hold the dispatch thread in the handler so the queue fills up
+    log->info ("first");
+    while (!handler.mEntered)
+        usleep (1000);
+
+    for (int i = 0; i < 20; i++)
+        log->info ("record %d", i);
+    ASSERT_EQ (mService->getDropped (), 17u);
+
+    handler.mOpen = 1;
+    for (int i = 0; i < 1000 && handler.mMessages.size () < 5; i++)
+        usleep (1000);
+
+    ASSERT_EQ (handler.mMessages.size (), 5u);
+    ASSERT_EQ (handler.mMessages[3], "record 2");
+    ASSERT_EQ (handler.mMessages[4], "17 records dropped");
+
+    mService->removeHandler (&handler);
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (mService->configure (sync, err));
+}
+
+TEST_F(logServiceTestHarness, TEST_HANDLER_THREADS_ISOLATE_SLOW_HANDLER)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+    p.setProperty ("logger.service.handler.threads", "true");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    gatedServiceHandler slow;
+    countingServiceHandler fast;
+    ASSERT_TRUE (mService->addHandler (&slow, err, false));
+    ASSERT_TRUE (mService->addHandler (&fast, err, false));
+
+    logger* log = logService::getLogger ("TEST_HANDLER_THREADS");
+    for (int i = 0; i < 100; i++)
+        log->info ("record %d", i);
+
+    // the fast handler sees everything while the slow one is stuck
+    for (int i = 0; i < 1000 && fast.mCount < 100; i++)
+        usleep (1000);
+    ASSERT_EQ (fast.mCount, 100);
+    ASSERT_TRUE (slow.mMessages.empty ());
+
+    logHandlerStats stats;
+    ASSERT_TRUE (mService->getHandlerStats (&slow, stats));
+    ASSERT_EQ (stats.mDepth, 100u);
+    ASSERT_GT (stats.mLag, 0u);
+
+    ASSERT_TRUE (mService->getHandlerStats (&fast, stats));
+    ASSERT_EQ (stats.mDepth, 0u);
+
+    // removing it lets the worker drain first
+    slow.mOpen = 1;
+    mService->removeHandler (&slow);
+    ASSERT_EQ (slow.mMessages.size (), 100u);
+    ASSERT_EQ (slow.mMessages[99], "record 99");
+    ASSERT_FALSE (mService->getHandlerStats (&slow, stats));
+
+    mService->removeHandler (&fast);
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (mService->configure (sync, err));
+}
+
+TEST_F(logServiceTestHarness, TEST_HANDLER_THREADS_DROP_WHEN_FULL)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.handler.threads", "true");
+    p.setProperty ("logger.service.handler.queue.capacity", "10");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    gatedServiceHandler slow;
+    ASSERT_TRUE (mService->addHandler (&slow, err, false));
+
+    // the slow handler's queue fills, logging never waits for it
+    logger* log = logService::getLogger ("TEST_HANDLER_THREADS_DROP");
+    for (int i = 0; i < 100; i++)
+        log->info ("record %d", i);
+
+    logHandlerStats stats;
+    ASSERT_TRUE (mService->getHandlerStats (&slow, stats));
+    ASSERT_EQ (stats.mDepth, 10u);
+    ASSERT_EQ (stats.mDropped, 90u);
+
+    slow.mOpen = 1;
+    for (int i = 0; i < 1000 && slow.mMessages.size () < 10; i++)
+        usleep (1000);
+
+    // counted once there is room again
+    log->info ("after");
+    mService->removeHandler (&slow);
+    ASSERT_EQ (slow.mMessages.size (), 12u);
+    ASSERT_EQ (slow.mMessages[9], "record 9");
+    ASSERT_EQ (slow.mMessages[10], "after");
+    ASSERT_EQ (slow.mMessages[11], "90 records dropped");
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (mService->configure (sync, err));
+}
+
+static const int kRegistryThreads = 4;
+static const int kRegistryNames = 200;
+
+static void*
+getLoggers (void* closure)
+{
+    logger** found = static_cast<logger**>(closure);
+
+    char name[32];
+    for (int i = 0; i < kRegistryNames; i++)
+    {
+        snprintf (name, sizeof name, "TEST_REGISTRY_%d", i);
+        found[i] = logService::getLogger (name);
+    }
+    return NULL;
+}
+
+TEST_F(logServiceTestHarness, TEST_CONCURRENT_GET_LOGGER)
+{
+    static logger* found[kRegistryThreads][kRegistryNames];
+
+    sbfThread threads[kRegistryThreads];
+    for (int i = 0; i < kRegistryThreads; i++)
+        ASSERT_EQ (sbfThread_create (&threads[i], getLoggers, found[i]), 0);
+    for (int i = 0; i < kRegistryThreads; i++)
+        sbfThread_join (threads[i]);
+
+    // every thread got the same logger for a name, each with its own id
+    std::set<uint32_t> ids;
+    for (int n = 0; n < kRegistryNames; n++)
+    {
+        for (int i = 1; i < kRegistryThreads; i++)
+            ASSERT_EQ (found[i][n], found[0][n]);
+
+        ASSERT_TRUE (ids.insert (found[0][n]->getId ()).second);
+        ASSERT_EQ (logService::getLoggerById (found[0][n]->getId ()),
+                   found[0][n]);
+    }
+}
+
+static volatile int reconfigureStop = 0;
+
+static void*
+logUntilStopped (void* closure)
+{
+    logger* log = logService::getLogger ("TEST_RECONFIGURE");
+    for (int i = 0; !reconfigureStop; i++)
+    {
+        if (i % 2 == 0)
+            log->info ("record %d", i);
+        else
+            log->info ("%s", "a plain record");
+    }
+    return NULL;
+}
+
+TEST_F(logServiceTestHarness, TEST_RECONFIGURE_WHILE_LOGGING)
+{
+    string err;
+    reconfigureStop = 0;
+
+    sbfThread threads[kRegistryThreads];
+    for (int i = 0; i < kRegistryThreads; i++)
+        ASSERT_EQ (sbfThread_create (&threads[i], logUntilStopped, NULL), 0);
+
+    // every change of queue is a restart under the producers
+    countingServiceHandler handler;
+    const char* backends[] = { "mpsc", "spsc" };
+    for (int i = 0; i < 40; i++)
+    {
+        char capacity[32];
+        snprintf (capacity, sizeof capacity, "%d", 1024 << (i % 3));
+
+        properties p;
+        p.setProperty ("lh.console.enabled", "false");
+        p.setProperty ("logger.service.async", i % 5 == 4 ? "false" : "true");
+        p.setProperty ("logger.service.deferred", i % 2 ? "true" : "false");
+        p.setProperty ("logger.service.queue.backend", backends[i / 2 % 2]);
+        p.setProperty ("logger.service.queue.capacity", capacity);
+        ASSERT_TRUE (mService->configure (p, err));
+        ASSERT_TRUE (mService->addHandler (&handler, err, false));
+        usleep (1000);
+    }
+
+    reconfigureStop = 1;
+    for (int i = 0; i < kRegistryThreads; i++)
+        sbfThread_join (threads[i]);
+    ASSERT_GT (handler.mCount, 0);
+    mService->removeHandler (&handler);
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (mService->configure (sync, err));
+}
+
+class namingServiceHandler : public logHandler
+{
+public:
+    namingServiceHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mName.assign (name);
+        __sync_fetch_and_add (&mCount, 1);
+    }
+
+    string          mName;
+    volatile int    mCount;
+};
+
+TEST_F(logServiceTestHarness, TEST_LOGGER_HANDLE_NAMES_ASYNC_RECORDS)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    namingServiceHandler handler;
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+
+    static loggerHandle log ("TEST_LOGGER_HANDLE");
+    ASSERT_EQ (log.get (), logService::getLogger ("TEST_LOGGER_HANDLE"));
+
+    // the record carries the id, the handler still sees the name
+    log->info ("by id");
+    for (int i = 0; i < 1000 && handler.mCount < 1; i++)
+        usleep (1000);
+    ASSERT_EQ (handler.mName, "TEST_LOGGER_HANDLE");
+
+    mService->removeHandler (&handler);
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (mService->configure (sync, err));
+}
+
+TEST_F(logServiceTestHarness, TEST_LOGGER_REJECTS_BELOW_HANDLER_LEVEL)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    logger* log = logService::getLogger ("TEST_HANDLER_LEVEL");
+    log->setLevel (logSeverity::TRACE);
+    // nothing to write to
+    ASSERT_FALSE (log->isLevelEnabled (logSeverity::ERROR));
+
+    countingServiceHandler handler;
+    handler.setLevel (logSeverity::WARN);
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+    ASSERT_EQ (mService->getHandlerLevel (), logSeverity::WARN);
+    ASSERT_FALSE (log->isLevelEnabled (logSeverity::INFO));
+    ASSERT_TRUE (log->isLevelEnabled (logSeverity::WARN));
+
+    // lowering a handler's level once added lets more through
+    handler.setLevel (logSeverity::DEBUG);
+    ASSERT_TRUE (log->isLevelEnabled (logSeverity::DEBUG));
+    ASSERT_FALSE (log->isLevelEnabled (logSeverity::TRACE));
+
+    // new loggers start out the same
+    logger* later = logService::getLogger ("TEST_HANDLER_LEVEL_LATER");
+    later->setLevel (logSeverity::TRACE);
+    ASSERT_FALSE (later->isLevelEnabled (logSeverity::TRACE));
+
+    // the logger's own level still applies
+    log->setLevel (logSeverity::ERROR);
+    ASSERT_FALSE (log->isLevelEnabled (logSeverity::WARN));
+    log->setLevel (logSeverity::TRACE);
+
+    log->trace ("rejected");
+    log->debug ("accepted");
+    ASSERT_EQ (handler.mCount, 1);
+
+    mService->removeHandler (&handler);
+    ASSERT_FALSE (log->isLevelEnabled (logSeverity::ERROR));
+}
+
+TEST_F(logServiceTestHarness, TEST_LOGGERS_INHERIT_LEVEL_RULES)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.level.rules.net.*", "debug");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+
+    countingServiceHandler handler;
+    handler.setLevel (logSeverity::TRACE);
+    ASSERT_TRUE (mService->addHandler (&handler, err, false));
+
+    logger* session = logService::getLogger ("rules.net.fix.session");
+    ASSERT_EQ (session->getLevel (), logSeverity::DEBUG);
+    ASSERT_TRUE (session->isLevelEnabled (logSeverity::DEBUG));
+    ASSERT_FALSE (session->isLevelEnabled (logSeverity::TRACE));
+
+    // the pattern covers what is below net, not net or its siblings
+    ASSERT_EQ (logService::getLogger ("rules.net")->getLevel (),
+               logSeverity::INFO);
+    ASSERT_EQ (logService::getLogger ("rules.network")->getLevel (),
+               logSeverity::INFO);
+
+    // the nearest rule wins, loggers that already exist follow it
+    logService::getLogger ("rules.net.fix")->setLevel (logSeverity::TRACE);
+    ASSERT_TRUE (session->isLevelEnabled (logSeverity::TRACE));
+    ASSERT_EQ (logService::getLogger ("rules.net.itch")->getLevel (),
+               logSeverity::DEBUG);
+
+    mService->setLevel ("rules.net.fix.session", logSeverity::WARN);
+    ASSERT_FALSE (session->isLevelEnabled (logSeverity::INFO));
+    ASSERT_EQ (logService::getLogger ("rules.net.fix")->getLevel (),
+               logSeverity::TRACE);
+
+    mService->removeHandler (&handler);
+}
+
+TEST_F(logServiceTestHarness, TEST_CONFIGURE_REPLACES_LEVEL_RULES)
+{
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.level.replace.a", "debug");
+    p.setProperty ("logger.level.replace.b", "warn");
+
+    string err;
+    ASSERT_TRUE (mService->configure (p, err));
+    mService->setLevel ("replace.c", logSeverity::ERROR);
+
+    logger* a = logService::getLogger ("replace.a");
+    logger* b = logService::getLogger ("replace.b");
+    logger* c = logService::getLogger ("replace.c");
+    ASSERT_EQ (a->getLevel (), logSeverity::DEBUG);
+    ASSERT_EQ (b->getLevel (), logSeverity::WARN);
+
+    // a rule no longer configured is gone, set ones stay
+    properties q;
+    q.setProperty ("lh.console.enabled", "false");
+    q.setProperty ("logger.level.replace.b", "trace");
+    ASSERT_TRUE (mService->configure (q, err));
+
+    ASSERT_EQ (a->getLevel (), logSeverity::INFO);
+    ASSERT_EQ (b->getLevel (), logSeverity::TRACE);
+    ASSERT_EQ (c->getLevel (), logSeverity::ERROR);
+}
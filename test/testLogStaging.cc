@@ -0,0 +1,282 @@
+/*
+ * Copyright 2014-2018 Neueda Ltd.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "logArgs.h"
+#include "logRegistry.h"
+#include "logStaging.h"
+#include "logger.h"
+#include "properties.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+using namespace neueda;
+using namespace std;
+
+static const size_t kProducers = 4;
+static const size_t kItemsPerProducer = 20000;
+
+struct stagingArgs
+{
+    logStaging* mStaging;
+    size_t      mId;
+    size_t      mItems;
+    uint64_t*   mClock;
+};
+
+static void*
+stage (void* closure)
+{
+    stagingArgs* args = static_cast<stagingArgs*>(closure);
+
+    char message[64];
+    for (size_t i = 0; i < args->mItems; i++)
+    {
+        // varying lengths so records wrap the ring at odd offsets
+        int len = snprintf (message, sizeof message, "%zu %*s", i, (int)(i % 40), "");
+        uint64_t time = __atomic_fetch_add (args->mClock, 1, __ATOMIC_RELAXED);
+        args->mStaging->write (args->mId, "", logSeverity::INFO, time, message, len);
+    }
+    return NULL;
+}
+
+static void
+startProducers (logStaging& staging,
+                sbfThread* threads,
+                stagingArgs* args,
+                size_t items,
+                uint64_t* clock)
+{
+    for (size_t i = 0; i < kProducers; i++)
+    {
+        args[i].mStaging = &staging;
+        args[i].mId = i;
+        args[i].mItems = items;
+        args[i].mClock = clock;
+        ASSERT_EQ (sbfThread_create (&threads[i], stage, &args[i]), 0);
+    }
+}
+
+static void
+runProducers (logWaiter::strategy strategy, size_t items)
+{
+    // smallest ring so producers regularly wait for the consumer
+    logStaging staging (0, strategy);
+    uint64_t clock = 0;
+
+    sbfThread threads[kProducers];
+    stagingArgs args[kProducers];
+    startProducers (staging, threads, args, items, &clock);
+
+    vector<size_t> next (kProducers, 0);
+    for (size_t n = 0; n < kProducers * items; n++)
+    {
+        const logRecord* record = staging.take ();
+        ASSERT_TRUE (record != NULL);
+
+        size_t id = record->mLoggerId;
+        ASSERT_LT (id, kProducers);
+
+        // each thread's records come out in the order they went in
+        size_t seq;
+        ASSERT_EQ (sscanf (record->getMessage (), "%zu", &seq), 1);
+        ASSERT_EQ (seq, next[id]);
+        next[id]++;
+
+        staging.release ();
+    }
+
+    for (size_t i = 0; i < kProducers; i++)
+        sbfThread_join (threads[i]);
+
+    staging.stop ();
+    ASSERT_TRUE (staging.take () == NULL);
+}
+
+TEST(logStagingTest, TEST_SPSC_KEEPS_THREAD_ORDER_BLOCK)
+{
+    runProducers (logWaiter::WAIT_BLOCK, kItemsPerProducer);
+}
+
+TEST(logStagingTest, TEST_SPSC_KEEPS_THREAD_ORDER_YIELD)
+{
+    runProducers (logWaiter::WAIT_YIELD, kItemsPerProducer);
+}
+
+TEST(logStagingTest, TEST_SPSC_MERGES_BY_TIMESTAMP)
+{
+    // everything staged up front, the consumer then sees all of it and
+    // must interleave the threads back into timestamp order
+    size_t items = 1000;
+    logStaging staging (1 << 17, logWaiter::WAIT_BLOCK);
+    uint64_t clock = 0;
+
+    sbfThread threads[kProducers];
+    stagingArgs args[kProducers];
+    startProducers (staging, threads, args, items, &clock);
+    for (size_t i = 0; i < kProducers; i++)
+        sbfThread_join (threads[i]);
+
+    staging.stop ();
+    for (uint64_t n = 0; n < kProducers * items; n++)
+    {
+        const logRecord* record = staging.take ();
+        ASSERT_TRUE (record != NULL);
+        ASSERT_EQ (record->mTime, n);
+        staging.release ();
+    }
+    ASSERT_TRUE (staging.take () == NULL);
+}
+
+static bool
+stageDeferred (logStaging& staging, const char* fmt, ...)
+{
+    va_list ap;
+    va_start (ap, fmt);
+    bool ok = staging.writeDeferred (logRegistry::kNoId,
+                                     "deferred",
+                                     logSeverity::WARN,
+                                     7,
+                                     fmt,
+                                     ap);
+    va_end (ap);
+    return ok;
+}
+
+TEST(logStagingTest, TEST_SPSC_DEFERRED_RECORD)
+{
+    logStaging staging (0, logWaiter::WAIT_BLOCK);
+
+    ASSERT_TRUE (stageDeferred (staging, "%s=%d", "answer", 42));
+    // not replayable, nothing may reach the consumer
+    ASSERT_FALSE (stageDeferred (staging, "%1$d", 1));
+
+    staging.stop ();
+    const logRecord* record = staging.take ();
+    ASSERT_TRUE (record != NULL);
+    ASSERT_STREQ (record->getName (), "deferred");
+    ASSERT_EQ (record->getSeverity (), logSeverity::WARN);
+
+    string out;
+    logArgs::render (out,
+                     record->mFormat,
+                     record->getMessage (),
+                     record->mMessageLen);
+    ASSERT_EQ (out, "answer=42");
+
+    staging.release ();
+    ASSERT_TRUE (staging.take () == NULL);
+}
+
+static void*
+stageOnce (void* closure)
+{
+    logStaging* staging = static_cast<logStaging*>(closure);
+    staging->write (0, "", logSeverity::INFO, 0, "once", 4);
+    return NULL;
+}
+
+static void*
+stageWhenPooled (void* closure)
+{
+    logStaging* staging = static_cast<logStaging*>(closure);
+
+    logPoolStats stats;
+    for (int i = 0; i < 1000; i++)
+    {
+        staging->getPoolStats (stats);
+        if (stats.mPooled > 0)
+            break;
+        usleep (1000);
+    }
+    return stageOnce (closure);
+}
+
+TEST(logStagingTest, TEST_SPSC_RECYCLES_RINGS_OF_EXITED_THREADS)
+{
+    logStaging staging (0, logWaiter::WAIT_BLOCK);
+
+    sbfThread thread;
+    ASSERT_EQ (sbfThread_create (&thread, stageOnce, &staging), 0);
+    sbfThread_join (thread);
+
+    ASSERT_TRUE (staging.take () != NULL);
+    staging.release ();
+
+    // the consumer pools the drained ring while it waits, the next thread
+    // to log picks it up
+    ASSERT_EQ (sbfThread_create (&thread, stageWhenPooled, &staging), 0);
+    ASSERT_TRUE (staging.take () != NULL);
+    staging.release ();
+    sbfThread_join (thread);
+
+    logPoolStats stats;
+    staging.getPoolStats (stats);
+    ASSERT_EQ (stats.mAllocated, 1u);
+    ASSERT_EQ (stats.mReused, 1u);
+    ASSERT_EQ (stats.mInUse, 1u);
+    ASSERT_EQ (stats.mPooled, 0u);
+    ASSERT_EQ (stats.mBufferSize, staging.getRingSize ());
+}
+
+class stagedLogHandler : public logHandler
+{
+public:
+    stagedLogHandler () : mCount (0) { }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        mMessages.push_back (string (message, message_len));
+        __sync_fetch_and_add (&mCount, 1);
+    }
+
+    vector<string>  mMessages;
+    volatile int    mCount;
+};
+
+TEST(logStagingTest, TEST_SPSC_SERVICE_BACKEND)
+{
+    logService& service = logService::get ();
+
+    properties p;
+    p.setProperty ("lh.console.enabled", "false");
+    p.setProperty ("logger.service.async", "true");
+    p.setProperty ("logger.service.deferred", "true");
+    p.setProperty ("logger.service.queue.backend", "spsc");
+
+    string err;
+    ASSERT_TRUE (service.configure (p, err));
+
+    stagedLogHandler* handler = new stagedLogHandler ();
+    ASSERT_TRUE (service.addHandler (handler, err, false));
+
+    logger* log = logService::getLogger ("TEST_STAGING");
+    log->info ("staged %d", 1);
+    // not replayable, falls back to formatting on this thread
+    log->info ("%1$s", "staged 2");
+
+    for (int i = 0; i < 1000 && handler->mCount < 2; i++)
+        usleep (1000);
+
+    ASSERT_EQ (handler->mCount, 2);
+    ASSERT_EQ (handler->mMessages[0], "staged 1");
+    ASSERT_EQ (handler->mMessages[1], "staged 2");
+
+    service.removeHandler (handler);
+    delete handler;
+
+    properties sync;
+    sync.setProperty ("lh.console.enabled", "false");
+    ASSERT_TRUE (service.configure (sync, err));
+}
@@ -7,6 +7,8 @@
 
 #include "logger.h"
 
+#include <vector>
+
 using namespace neueda;
 using namespace std;
 
@@ -672,3 +674,106 @@ TEST_F(LogHandlerStreamApiTestHarness,
     EXPECT_CALL (*handler, teardown ()).Times (1);
     service.removeHandler (handler);
 }
+
+class lineLogHandler : public logHandler
+{
+public:
+    lineLogHandler () { sbfMutex_init (&mMutex, 0); }
+
+    ~lineLogHandler () { sbfMutex_destroy (&mMutex); }
+
+    void handle (logSeverity::level severity,
+                 const char* name,
+                 uint64_t time,
+                 const char* message,
+                 size_t message_len)
+    {
+        sbfMutex_lock (&mMutex);
+        mLines.push_back (string (message, message_len));
+        sbfMutex_unlock (&mMutex);
+    }
+
+    sbfMutex        mMutex;
+    vector<string>  mLines;
+};
+
+struct countedValue
+{
+    countedValue () : mFormatted (0) { }
+
+    mutable int mFormatted;
+};
+
+static ostream&
+operator<< (ostream& os, const countedValue& value)
+{
+    value.mFormatted++;
+    return os << "value";
+}
+
+static const int kStreamThreads = 4;
+static const int kStreamLines = 2000;
+
+static void*
+streamLines (void* closure)
+{
+    logger* log = static_cast<logger*>(closure);
+    for (int i = 0; i < kStreamLines; i++)
+        log->info () << "part one " << i << " part two " << i << logger::endl;
+    return NULL;
+}
+
+TEST_F(LogHandlerStreamApiTestHarness, TEST_THREADS_BUILD_SEPARATE_LINES)
+{
+    logService& service = logService::get ();
+    lineLogHandler handler;
+    handler.setLevel (logSeverity::TRACE);
+
+    string errorMessage;
+    ASSERT_TRUE (service.addHandler (&handler, errorMessage, false));
+
+    sbfThread threads[kStreamThreads];
+    for (int i = 0; i < kStreamThreads; i++)
+        ASSERT_EQ (sbfThread_create (&threads[i], streamLines, mLogger), 0);
+    for (int i = 0; i < kStreamThreads; i++)
+        sbfThread_join (threads[i]);
+
+    service.removeHandler (&handler);
+
+    ASSERT_EQ (handler.mLines.size (), (size_t)(kStreamThreads * kStreamLines));
+    for (size_t i = 0; i < handler.mLines.size (); i++)
+    {
+        int a = -1;
+        int b = -2;
+        ASSERT_EQ (sscanf (handler.mLines[i].c_str (),
+                           "part one %d part two %d",
+                           &a,
+                           &b), 2);
+        ASSERT_EQ (a, b);
+    }
+}
+
+TEST_F(LogHandlerStreamApiTestHarness, TEST_DISABLED_LEVEL_IS_NOT_FORMATTED)
+{
+    logService& service = logService::get ();
+    lineLogHandler handler;
+    handler.setLevel (logSeverity::TRACE);
+
+    string errorMessage;
+    ASSERT_TRUE (service.addHandler (&handler, errorMessage, false));
+
+    countedValue value;
+    mLogger->setLevel (logSeverity::INFO);
+    mLogger->debug () << value << logger::endl;
+    ASSERT_EQ (value.mFormatted, 0);
+
+    // longer than the initial line buffer
+    string longer (1000, 'x');
+    mLogger->info () << value << " " << longer << logger::endl;
+    ASSERT_EQ (value.mFormatted, 1);
+
+    service.removeHandler (&handler);
+
+    ASSERT_EQ (handler.mLines.size (), 1u);
+    ASSERT_EQ (handler.mLines[0], "value " + longer);
+}